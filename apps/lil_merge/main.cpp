@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <lt/lt.h>
+
+void print_usage(const char* exe) {
+    std::cout << "Usage: " << exe << " [-o image.exr] shard.ckpt [shard.ckpt ...]\n"
+              << "  Merge the checkpoints of the shards of a render, see lil_tracer --shard.\n"
+              << "  -o FILE            merged image, merged.exr by default\n";
+}
+
+/**
+ * @brief Checkpoint of a shard and the sample range it holds.
+ */
+struct Shard {
+    std::string path;
+    lt::CheckpointInfo info;
+};
+
+/**
+ * @brief Create an empty sensor able to load the checkpoints described by info,
+ * with the type, crop window and output of the rendered one.
+ * @return nullptr, with a message, if the sensor cannot be created.
+ */
+std::shared_ptr<lt::Sensor> make_sensor(const lt::CheckpointInfo& info) {
+    std::shared_ptr<lt::Sensor> sensor = lt::Factory<lt::Sensor>::create(info.type);
+    if (!sensor) {
+        std::cerr << "Unknown sensor type " << info.type << std::endl;
+        return nullptr;
+    }
+    if (lt::VarianceSensor* variance_sensor = dynamic_cast<lt::VarianceSensor*>(sensor.get()))
+        variance_sensor->output_variance = info.output_variance;
+    sensor->w = info.w;
+    sensor->h = info.h;
+    sensor->precision = info.precision;
+    sensor->aovs = info.aovs;
+    if (!sensor->set_crop(info.crop))
+        return nullptr;
+    sensor->init();
+    return sensor;
+}
+
+int main(int argc, char* argv[])
+{
+    lt::State::log_level = lt::logWarning;
+
+    std::string output = "merged.exr";
+    std::vector<Shard> shards;
+
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "-o") {
+            if (a + 1 >= argc) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            output = argv[++a];
+        } else {
+            shards.push_back({ arg, {} });
+        }
+    }
+
+    if (shards.empty()) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    for (Shard& shard : shards) {
+        if (!lt::read_checkpoint_info(shard.path, shard.info))
+            return 1;
+    }
+
+    // All the shards must come from the same scene and sensor
+    const lt::CheckpointInfo& ref = shards[0].info;
+    for (const Shard& shard : shards) {
+        const lt::CheckpointInfo& info = shard.info;
+        if (info.scene_hash != ref.scene_hash) {
+            std::cerr << shard.path << " was rendered from another scene than " << shards[0].path << std::endl;
+            return 1;
+        }
+        if (info.type != ref.type || info.w != ref.w || info.h != ref.h || info.crop != ref.crop || info.precision != ref.precision
+            || info.variance != ref.variance || info.aovs != ref.aovs || info.output_variance != ref.output_variance) {
+            std::cerr << shard.path << " was rendered with another sensor than " << shards[0].path << std::endl;
+            return 1;
+        }
+    }
+
+    // The sample ranges must not overlap, a sample would be counted twice
+    std::sort(shards.begin(), shards.end(), [](const Shard& a, const Shard& b) {
+        return a.info.first_sample < b.info.first_sample;
+    });
+    for (size_t i = 1; i < shards.size(); i++) {
+        const lt::CheckpointInfo& prev = shards[i - 1].info;
+        const lt::CheckpointInfo& info = shards[i].info;
+        if (info.first_sample < prev.n_sample) {
+            std::cerr << shards[i].path << " and " << shards[i - 1].path << " hold the same samples" << std::endl;
+            return 1;
+        }
+        if (info.first_sample > prev.n_sample)
+            std::cerr << "Warning : samples " << prev.n_sample - 1 << " to " << info.first_sample - 1
+                      << " are missing between " << shards[i - 1].path << " and " << shards[i].path << std::endl;
+    }
+
+    std::shared_ptr<lt::Sensor> sensor = make_sensor(ref);
+    std::shared_ptr<lt::Sensor> shard_sensor = make_sensor(ref);
+    if (!sensor || !shard_sensor)
+        return 1;
+
+    uint32_t spp = 0;
+    for (const Shard& shard : shards) {
+        uint32_t n_sample;
+        if (!lt::load_checkpoint(shard.path, *shard_sensor, n_sample, ref.scene_hash))
+            return 1;
+        sensor->merge(*shard_sensor);
+        spp += n_sample - shard.info.first_sample;
+        std::cout << shard.path << " : samples " << shard.info.first_sample - 1 << " to " << n_sample - 1 << std::endl;
+    }
+
+    std::cout << "Merged " << shards.size() << " shards, " << spp << " samples per pixel" << std::endl;
+
+    if (lt::save_sensor_exr(*sensor, output) != 0)
+        return 1;
+
+    if (ref.aovs) {
+        std::filesystem::path aov_path = output;
+        aov_path.replace_extension(".aovs.exr");
+        lt::save_aov_exr(*sensor, aov_path.string());
+    }
+
+    return 0;
+}
@@ -1,4 +1,9 @@
+#include <charconv>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <lt/lt.h>
 
 #define PBSTR "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||"
@@ -14,6 +19,258 @@ void print_progress(int current_sample, int max_sample, float t) {
     fflush(stdout);
 }
 
+void print_status(int current_sample, float elapsed, float budget, float error) {
+    printf("\r%d spp  %.1f", current_sample, elapsed);
+    if (budget > 0.)
+        printf("/%.1f", budget);
+    printf(" (s)");
+    if (error >= 0.)
+        printf("  rel. error %f", error);
+    printf("        ");
+    fflush(stdout);
+}
+
+/**
+ * @brief Settings given on the command line, they override the scene file.
+ */
+struct Options {
+    int threads = -1;
+    int tile_size = -1;
+    std::string tile_order;
+    int spp_per_pass = -1;
+    float time_budget = -1.;
+    float target_rel_error = -1.;
+    bool denoise = false;
+    bool stream = false;
+    float checkpoint = -1.;
+    bool resume = false;
+    int shard_index = -1;
+    int shard_count = 0;
+    std::vector<uint32_t> crop;
+    lt::RtcSettings rtc_settings;
+    std::vector<std::string> scenes;
+};
+
+void print_usage(const char* exe) {
+    std::cout << "Usage: " << exe << " [options] scene.json [scene.json ...]\n"
+              << "  --threads N        number of render threads (0 : all hardware threads)\n"
+              << "  --tile-size N      size of the side of a tile in pixels\n"
+              << "  --tile-order NAME  scanline, spiral or hilbert\n"
+              << "  --spp-per-pass N   samples per pixel rendered by each pass\n"
+              << "  --time-budget S    render passes until S seconds have elapsed\n"
+              << "  --target-rel-error X\n"
+              << "                     render passes until the mean relative error is under X\n"
+              << "  --denoise          also save the denoised image in <scene>.json.denoised.exr\n"
+              << "  --stream           render tile by tile and stream the tiles to a tiled EXR\n"
+              << "  --checkpoint S     save the samples in <scene>.json.ckpt every S seconds and at the end\n"
+              << "  --resume           continue from <scene>.json.ckpt if it exists\n"
+              << "  --crop X0,Y0,X1,Y1 only render the pixels of the window [X0, X1) x [Y0, Y1)\n"
+              << "  --shard I/N        render the I-th of N disjoint sample ranges into\n"
+              << "                     <scene>.json.shard-I-of-N.ckpt, combined by lil_merge\n"
+              << "  --build-quality Q  build quality of the BVH : low, medium or high\n"
+              << "  --geometry-build-quality Q\n"
+              << "                     build quality of every geometry, over the scene file\n"
+              << "  --scene-flags F    comma separated Embree scene flags : compact, robust, dynamic or none\n"
+              << "  --device-config S  Embree device configuration string, ex: threads=8,verbose=1\n"
+              << "  --benchmark-bvh    trace random rays after the BVH build and report the throughput\n";
+}
+
+/**
+ * @brief Parse the whole value of an option as a number.
+ * @return False, with a message, if the value is not a number.
+ */
+template<typename T>
+bool parse_number(const std::string& arg, const std::string& value, T& result) {
+    const char* end = value.data() + value.size();
+    auto [ptr, ec] = std::from_chars(value.data(), end, result);
+    if (value.empty() || ec != std::errc() || ptr != end) {
+        std::cerr << arg << " expects a number, got " << value << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool parse_options(int argc, char* argv[], Options& opt) {
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+
+        if (!arg.starts_with("--")) {
+            opt.scenes.push_back(arg);
+            continue;
+        }
+
+        if (arg == "--denoise") {
+            opt.denoise = true;
+            continue;
+        }
+
+        if (arg == "--stream") {
+            opt.stream = true;
+            continue;
+        }
+
+        if (arg == "--resume") {
+            opt.resume = true;
+            continue;
+        }
+
+        if (arg == "--benchmark-bvh") {
+            opt.rtc_settings.benchmark = true;
+            continue;
+        }
+
+        if (a + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++a];
+
+        if (arg == "--threads") {
+            if (!parse_number(arg, value, opt.threads))
+                return false;
+        }
+        else if (arg == "--tile-size") {
+            if (!parse_number(arg, value, opt.tile_size))
+                return false;
+        }
+        else if (arg == "--tile-order")
+            opt.tile_order = value;
+        else if (arg == "--spp-per-pass") {
+            if (!parse_number(arg, value, opt.spp_per_pass))
+                return false;
+        }
+        else if (arg == "--time-budget") {
+            if (!parse_number(arg, value, opt.time_budget))
+                return false;
+        }
+        else if (arg == "--target-rel-error") {
+            if (!parse_number(arg, value, opt.target_rel_error))
+                return false;
+        }
+        else if (arg == "--checkpoint") {
+            if (!parse_number(arg, value, opt.checkpoint))
+                return false;
+        }
+        else if (arg == "--crop") {
+            std::stringstream ss(value);
+            std::string coord;
+            opt.crop.clear();
+            while (std::getline(ss, coord, ',')) {
+                uint32_t c = 0;
+                if (!parse_number(arg, coord, c))
+                    return false;
+                opt.crop.push_back(c);
+            }
+            if (opt.crop.size() != 4) {
+                std::cerr << "--crop expects X0,Y0,X1,Y1, got " << value << std::endl;
+                return false;
+            }
+        }
+        else if (arg == "--build-quality") {
+            RTCBuildQuality quality;
+            if (!lt::build_quality_from_string(value, quality))
+                return false;
+            opt.rtc_settings.quality = quality;
+        }
+        else if (arg == "--geometry-build-quality") {
+            RTCBuildQuality quality;
+            if (!lt::build_quality_from_string(value, quality))
+                return false;
+            opt.rtc_settings.geometry_quality = quality;
+        }
+        else if (arg == "--scene-flags") {
+            RTCSceneFlags flags;
+            if (!lt::scene_flags_from_string(value, flags))
+                return false;
+            opt.rtc_settings.flags = flags;
+        }
+        else if (arg == "--device-config")
+            opt.rtc_settings.device_config = value;
+        else if (arg == "--shard") {
+            size_t slash = value.find('/');
+            if (slash == std::string::npos) {
+                std::cerr << "--shard expects I/N, got " << value << std::endl;
+                return false;
+            }
+            if (!parse_number(arg, value.substr(0, slash), opt.shard_index) || !parse_number(arg, value.substr(slash + 1), opt.shard_count))
+                return false;
+            if (opt.shard_count <= 0 || opt.shard_index < 0 || opt.shard_index >= opt.shard_count) {
+                std::cerr << "--shard expects 0 <= I < N, got " << value << std::endl;
+                return false;
+            }
+        }
+        else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Hash of the content of a scene file, 0 if it cannot be read.
+ */
+uint64_t hash_file(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return file ? lt::hash_bytes(content.data(), content.size()) : 0;
+}
+
+bool apply_options(const Options& opt, lt::Renderer& ren) {
+    if (opt.threads >= 0)
+        ren.scheduler->set_threads(opt.threads);
+    if (opt.tile_size > 0)
+        ren.scheduler->tile_size = opt.tile_size;
+    if (!opt.tile_order.empty() && !lt::tile_order_from_string(opt.tile_order, ren.scheduler->tile_order))
+        return false;
+    if (opt.spp_per_pass > 0)
+        ren.integrator->spp_per_pass = opt.spp_per_pass;
+    if (opt.denoise && !ren.denoiser)
+        ren.denoiser = std::make_shared<lt::Denoiser>();
+    if (!opt.crop.empty() && !ren.sensor->set_crop(lt::Window { opt.crop[0], opt.crop[1], opt.crop[2], opt.crop[3] }))
+        return false;
+
+    // Release the per pixel buffers, the scene file can set streamed to never allocate them
+    if (opt.stream && !ren.sensor->streamed) {
+        ren.sensor->streamed = true;
+        ren.sensor->init();
+    }
+
+    if (ren.sensor->streamed) {
+        if (opt.time_budget > 0. || opt.target_rel_error > 0. || opt.checkpoint > 0. || opt.resume
+            || opt.shard_count > 0 || ren.adaptive || ren.denoiser || ren.sensor->aovs) {
+            std::cerr << "A streamed render takes max_sample samples per pixel and only saves the image, it cannot be combined"
+                      << " with a time budget, an error target, checkpoints, shards, adaptive sampling, the denoiser or AOVs" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Each shard renders a fixed range of sample indices, the merge needs all of them
+    if (opt.shard_count > 0 && (opt.time_budget > 0. || opt.target_rel_error > 0. || ren.adaptive || ren.denoiser)) {
+        std::cerr << "A shard renders a fixed range of samples per pixel, it cannot be combined"
+                  << " with a time budget, an error target, adaptive sampling or the denoiser" << std::endl;
+        return false;
+    }
+
+    // The error estimate needs the squared samples of a VarianceSensor
+    if (opt.target_rel_error > 0. && !std::dynamic_pointer_cast<lt::VarianceSensor>(ren.sensor)) {
+        if (ren.sensor->type != "Sensor") {
+            std::cerr << "--target-rel-error needs a Sensor or a VarianceSensor, got " << ren.sensor->type << std::endl;
+            return false;
+        }
+        std::shared_ptr<lt::VarianceSensor> sensor = std::make_shared<lt::VarianceSensor>(ren.sensor->w, ren.sensor->h);
+        sensor->output_variance = false;
+        sensor->precision = ren.sensor->precision;
+        sensor->filter = ren.sensor->filter;
+        sensor->aovs = ren.sensor->aovs;
+        sensor->crop = ren.sensor->crop;
+        sensor->init();
+        ren.sensor = sensor;
+    }
+    return true;
+}
+
 int main(int argc, char* argv[])
 {   
 #ifdef NDEBUG
@@ -22,26 +279,164 @@ int main(int argc, char* argv[])
     lt::State::log_level = lt::logDebug;
 #endif // NDEBUG
 
-    for (int a = 1; a < argc; a++) {
+    Options opt;
+    if (!parse_options(argc, argv, opt) || opt.scenes.empty()) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    for (const std::string& path : opt.scenes) {
 
         lt::Renderer ren;
         lt::Scene scn;
+        scn.rtc_settings = opt.rtc_settings;
+
+        if (!lt::generate_from_path(path, scn, ren)) {
+            std::cerr << "Cannot load the scene " << path << std::endl;
+            return 1;
+        }
+        std::cout << scn.rtc_report() << std::endl;
+
+        if (!apply_options(opt, ren))
+            return 1;
 
-        lt::generate_from_path(argv[a], scn, ren);
+        if (ren.sensor->streamed) {
+            lt::TiledExrWriter writer;
+            if (!writer.open(path + ".exr", ren.sensor->w, ren.sensor->h, ren.sensor->window(), ren.scheduler->tile_size))
+                return 1;
+
+            uint32_t n_tiles = (uint32_t)ren.scheduler->tiles(ren.sensor->window()).size();
+            std::atomic<uint32_t> n_done = 0;
+            std::atomic<bool> ok = true;
+
+            float time = ren.integrator->render_tile_major(ren.camera, ren.sensor, scn, *ren.scheduler, std::max(ren.max_sample, 1),
+                [&](const lt::Tile& tile, const lt::FilmTile& film) {
+                    if (!writer.write_tile(tile, film))
+                        ok = false;
+                    uint32_t done = ++n_done;
+                    printf("\r%u/%u tiles", done, n_tiles);
+                    fflush(stdout);
+                });
+
+            std::cout << "\nTime elapsed : " << time << " (ms) " << std::endl;
+
+            if (!writer.close() || !ok)
+                return 1;
+            continue;
+        }
 
         float time = 0.;
 
-        for (int s = 0; s < ren.max_sample;  s++) {
+        std::string checkpoint_path = path + ".ckpt";
+        uint64_t scene_hash = hash_file(path);
+        int first_sample = 0;
+
+        // With a time budget or an error target max_sample is ignored
+        bool open_ended = opt.time_budget > 0. || opt.target_rel_error > 0.;
+        int max_sample = open_ended ? std::numeric_limits<int>::max() : ren.max_sample;
+
+        // A shard renders the sample indices [start, end) of the max_sample of each pixel
+        bool shard = opt.shard_count > 0;
+        int shard_start = 0;
+        if (shard) {
+            shard_start = (int)((int64_t)max_sample * opt.shard_index / opt.shard_count);
+            max_sample = (int)((int64_t)max_sample * (opt.shard_index + 1) / opt.shard_count);
+            first_sample = shard_start;
+            ren.integrator->n_sample = shard_start + 1;
+            checkpoint_path = path + ".shard-" + std::to_string(opt.shard_index) + "-of-" + std::to_string(opt.shard_count) + ".ckpt";
+            std::cout << "Shard " << opt.shard_index << "/" << opt.shard_count << " : samples " << shard_start << " to " << max_sample << std::endl;
+        }
+
+        if (opt.resume && std::filesystem::exists(checkpoint_path)) {
+            // Never overwrite a checkpoint that does not match the scene
+            uint32_t n_sample;
+            if (!lt::load_checkpoint(checkpoint_path, *ren.sensor, n_sample, scene_hash))
+                return 1;
+            ren.integrator->n_sample = n_sample;
+            first_sample = (int)n_sample - 1;
+            if (ren.adaptive)
+                ren.adaptive->update(*ren.sensor, *ren.scheduler);
+            std::cout << "Resumed from " << checkpoint_path << " after " << first_sample - shard_start << " samples" << std::endl;
+        }
+
+        int spp = std::max((int)ren.integrator->spp_per_pass, 1);
+        std::shared_ptr<lt::VarianceSensor> variance_sensor = std::dynamic_pointer_cast<lt::VarianceSensor>(ren.sensor);
+
+        auto start = std::chrono::steady_clock::now();
+        auto last_checkpoint = start;
+
+        for (int s = first_sample; s < max_sample;  s += spp) {
+            // The last pass only renders the remaining samples
+            ren.integrator->spp_per_pass = std::min(spp, max_sample - s);
+
             float t = ren.render(scn);
 
             time += t;
 
-            print_progress(s,ren.max_sample, t);
+            int n_sample = s + ren.integrator->spp_per_pass;
+
+            if (!open_ended) {
+                print_progress(n_sample - 1, max_sample, t);
+            } else {
+                float elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+                // The adaptive sampling already has the error of each tile of the pass
+                float error = -1.f;
+                if (opt.target_rel_error > 0.)
+                    error = ren.adaptive ? ren.adaptive->image_error() : lt::AdaptiveSampling::image_error(*variance_sensor, *ren.scheduler);
+                print_status(n_sample, elapsed, opt.time_budget, error);
+
+                if (opt.target_rel_error > 0. && error <= opt.target_rel_error) {
+                    std::cout << "\nRelative error reached after " << n_sample << " samples";
+                    break;
+                }
+                // Stop if the next pass, as long as the last one, would end past the budget
+                if (opt.time_budget > 0. && elapsed + t / 1000.f > opt.time_budget) {
+                    std::cout << "\nTime budget reached after " << n_sample << " samples";
+                    break;
+                }
+            }
+
+            if (ren.converged()) {
+                std::cout << "\nAll tiles converged after " << n_sample << " samples";
+                break;
+            }
+
+            if (opt.checkpoint > 0. && std::chrono::duration<float>(std::chrono::steady_clock::now() - last_checkpoint).count() > opt.checkpoint) {
+                lt::save_checkpoint(checkpoint_path, *ren.sensor, shard_start + 1, ren.integrator->n_sample, scene_hash);
+                last_checkpoint = std::chrono::steady_clock::now();
+            }
+        }
+
+        if (opt.checkpoint > 0. || shard) {
+            if (!lt::save_checkpoint(checkpoint_path, *ren.sensor, shard_start + 1, ren.integrator->n_sample, scene_hash))
+                return 1;
         }
 
         std::cout << "\nTime elapsed : " << time << " (ms) " << std::endl;
 
-        lt::save_sensor_exr(*ren.sensor, std::string(argv[a]) + ".exr");
+        // The image of a shard is only a part of the samples, see lil_merge
+        if (shard)
+            continue;
+
+        lt::save_sensor_exr(*ren.sensor, path + ".exr");
+
+        if (ren.adaptive)
+            lt::save_sample_count_exr(*ren.sensor, path + ".spp.exr");
+
+        if (ren.sensor->aovs)
+            lt::save_aov_exr(*ren.sensor, path + ".aovs.exr");
+
+        if (ren.denoiser) {
+            std::vector<lt::Spectrum> denoised;
+            auto start_denoise = std::chrono::steady_clock::now();
+            ren.denoiser->run(*ren.sensor, *ren.scheduler, denoised);
+            float denoise_time = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start_denoise).count();
+            std::cout << "Denoised in " << denoise_time << " (ms) " << std::endl;
+            if (ren.sensor->window() != lt::Window { 0, 0, ren.sensor->w, ren.sensor->h })
+                lt::save_image_exr_window(denoised, ren.sensor->w, ren.sensor->h, ren.sensor->window(), path + ".denoised.exr");
+            else
+                lt::save_image_exr(denoised, ren.sensor->w, ren.sensor->h, path + ".denoised.exr");
+        }
         
     }
 
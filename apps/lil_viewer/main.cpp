@@ -37,6 +37,13 @@ struct RenderSensor {
     std::shared_ptr<lt::Sensor> sensor = nullptr;
     bool initialized = false;
 
+    // Denoising of the displayed image, run between two passes on the
+    // scheduler of the renderer
+    bool denoise = false;
+    lt::Denoiser denoiser;
+    std::vector<lt::Spectrum> denoised;
+    std::vector<lt::Spectrum> pixels; /**< Interleaved copy of the value planes of the sensor, uploaded to the texture. */
+
     enum Type
     {
         Spectrum = 0,
@@ -53,14 +60,26 @@ struct RenderSensor {
 
     Type type;
 
-    bool update_data() {
+    // The sensor must not be rendering, the scheduler is only used to denoise
+    bool update_data(lt::Scheduler* scheduler = nullptr) {
 
         if (!initialized) {
             return false;
         }
         // Push sensor data in opengl sensor texture
+        const lt::Spectrum* data;
+        if (denoise && scheduler) {
+            denoiser.run(*sensor, *scheduler, denoised);
+            data = denoised.data();
+        } else {
+            sensor->resolve();
+            pixels.resize(sensor->value.size());
+            for (size_t idx = 0; idx < pixels.size(); idx++)
+                pixels[idx] = sensor->value.get(idx);
+            data = pixels.data();
+        }
         glBindTexture(GL_TEXTURE_2D, sensor_id);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, sensor->w, sensor->h, 0, GL_RGB, GL_FLOAT, sensor->value.data());
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, sensor->w, sensor->h, 0, GL_RGB, GL_FLOAT, data);
 
         // Process sensor
         // Apply tonemapping
@@ -195,11 +214,21 @@ struct RenderSensor {
 
 
 struct RenderableScene {
+    RenderableScene()
+    {
+        // Edits rebuild the BVH, fast low quality builds over the settings of the scene files
+        scn.rtc_settings.quality = RTC_BUILD_QUALITY_LOW;
+        scn.rtc_settings.flags = RTC_SCENE_FLAG_DYNAMIC;
+    }
+
     lt::Scene    scn;
     lt::RendererAsync ren;
     RenderSensor rsen;
     bool pause = false;
+    bool need_update = false; /**< The image changed since it was last displayed. */
     std::string path;
+    bool cropping = false; /**< A crop window is being dragged. */
+    ImPlotPoint crop_start; /**< Corner of the crop window where the drag started, in plot coordinates. */
 };
 
 static lt::gl::Scene opengl_scene;
@@ -259,6 +288,25 @@ void new_opengl_scene(std::shared_ptr<RenderableScene> r, int scn_idx) {
             }
             render_mode = GL_TRIANGLES;
         }
+        else if (g->type == "Instance") {
+            // The preview holds a transformed copy of the prototype mesh
+            std::shared_ptr<lt::Instance> inst = std::reinterpret_pointer_cast<lt::Instance>(g);
+            std::shared_ptr<lt::TriangleMesh> m = std::dynamic_pointer_cast<lt::TriangleMesh>(inst->prototype->geometry);
+            if (m) {
+                vertices.resize(m->vertex.size());
+                indices.resize(m->triangle_indices.size() * 3);
+                for (int i = 0; i < m->vertex.size(); i++) {
+                    vertices[i] = { glm::vec3(inst->local_to_world * glm::vec4(m->vertex[i], 1)),
+                        glm::normalize(inst->normal_to_world * m->normal[i]) };
+                }
+                for (int i = 0; i < m->triangle_indices.size(); i++) {
+                    indices[3 * i]     = m->triangle_indices[i].x;
+                    indices[3 * i + 1] = m->triangle_indices[i].y;
+                    indices[3 * i + 2] = m->triangle_indices[i].z;
+                }
+            }
+            render_mode = GL_TRIANGLES;
+        }
         else if (g->type == "Sphere") {
             std::shared_ptr<lt::Sphere> s = std::reinterpret_pointer_cast<lt::Sphere>(g);;
             lt::gl::solid_sphere(vertices, indices, s->rad, 10, 10);
@@ -383,23 +431,29 @@ struct AppData {
 static AppData app_data;
 
 
-void render_overlay(lt::RendererAsync& ren, const ImVec2& work_pos, bool& pause) {
+void render_overlay(lt::RendererAsync& ren, const ImVec2& work_pos, bool& pause, bool& denoise) {
     bool p_open = true;
     ImGuiWindowFlags window_flags = 0;
 
     ImGui::SetNextWindowPos(work_pos, ImGuiCond_Always);
     ImGui::SetNextWindowBgAlpha(0.25f); // Transparent background
      
-    if (ImGui::BeginChild("overlay", ImVec2(125,110), 0, window_flags))
+    if (ImGui::BeginChild("overlay", ImVec2(125,160), 0, window_flags))
     {
         if (ImGui::Button("Save")) {
+            // The workers must not merge tiles while the sensor is resolved
+            ren.wait();
             lt::save_sensor_exr(*ren.sensor, "save.exr");
         }
         if (ImGui::Button(pause ? "Resume" : "Pause")) {
             pause = !pause;
         }
+        ImGui::Checkbox("Denoise", &denoise);
+        lt::Window window = ren.sensor->window();
+        if (window != lt::Window { 0, 0, ren.sensor->w, ren.sensor->h } && ImGui::Button("Full frame"))
+            ren.set_crop(lt::Window { 0, 0, 0, 0 });
         ImGui::Text("%.0f ms/frame", ren.delta_time_ms);
-        ImGui::Text("%d ssp", ren.sensor->n_sample(0,0));
+        ImGui::Text("%d ssp", ren.sensor->n_sample(window.x_min, window.y_min));
 
         ImGui::EndChild();
     }
@@ -440,7 +494,7 @@ void brdf_slice(std::shared_ptr<lt::Brdf> brdf, float th_i, float ph_i, std::sha
     for (int x = 0; x < sensor->w; x++) {
         for (int y = 0; y < sensor->h; y++) {
             lt::vec3 wo = lt::polar_to_card(th[y], ph[x]);
-            sensor->value[y * sensor->w + x] = brdf->eval(wi, wo, si, sampler);
+            sensor->value.set(y * sensor->w + x, brdf->eval(wi, wo, si, sampler));
         }
     }
 }
@@ -709,22 +763,69 @@ static void tab_brdf_sampling(AppData& app_data, bool& open) {
     }
 }
 
+/**
+ * @brief Select the crop window of a render with Ctrl + left drag on its image,
+ * Ctrl + click goes back to the full frame. Called between BeginPlot and EndPlot.
+ */
+static void select_crop(std::shared_ptr<RenderableScene> r) {
+    ImPlotPoint mouse = ImPlot::GetPlotMousePos();
+
+    if (ImPlot::IsPlotHovered() && ImGui::GetIO().KeyCtrl && ImGui::IsMouseClicked(ImGuiMouseButton_Left)) {
+        r->cropping = true;
+        r->crop_start = mouse;
+    }
+    if (!r->cropping)
+        return;
+
+    ImVec2 p0 = ImPlot::PlotToPixels(r->crop_start);
+    ImVec2 p1 = ImPlot::PlotToPixels(mouse);
+    ImPlot::GetPlotDrawList()->AddRect(ImVec2(std::min(p0.x, p1.x), std::min(p0.y, p1.y)),
+        ImVec2(std::max(p0.x, p1.x), std::max(p0.y, p1.y)), IM_COL32(255, 255, 0, 255));
+
+    if (!ImGui::IsMouseReleased(ImGuiMouseButton_Left))
+        return;
+    r->cropping = false;
+
+    // The first row of the sensor is drawn at the top of the plot
+    double w = r->ren.sensor->w;
+    double h = r->ren.sensor->h;
+    double x0 = std::clamp(std::min(r->crop_start.x, mouse.x), 0., w);
+    double x1 = std::clamp(std::max(r->crop_start.x, mouse.x), 0., w);
+    double y0 = std::clamp(h - std::max(r->crop_start.y, mouse.y), 0., h);
+    double y1 = std::clamp(h - std::min(r->crop_start.y, mouse.y), 0., h);
+    lt::Window crop { (uint32_t)std::floor(x0), (uint32_t)std::floor(y0), (uint32_t)std::ceil(x1), (uint32_t)std::ceil(y1) };
+
+    // A click without drag goes back to the full frame
+    if (crop.width() < 2 || crop.height() < 2)
+        crop = lt::Window { 0, 0, 0, 0 };
+    r->ren.set_crop(crop);
+}
+
 static void render_scn(std::shared_ptr<RenderableScene> r, bool& open) {
 
-    if (!r->pause) {
-        if (r->ren.render(r->scn) && !r->ren.need_reset) {
-            r->rsen.update_data();
+    // The sensor is only read between two passes, never while the workers write it
+    if (r->ren.done) {
+        if (r->need_update && !r->ren.need_reset) {
+            r->rsen.update_data(r->ren.scheduler.get());
+            r->need_update = false;
         }
+        if (!r->pause && r->ren.render(r->scn))
+            r->need_update = true;
     }
 
     ImVec2 work_pos;
     if (ImPlot::BeginPlot("##image", "", "", ImVec2(-1, -1), ImPlotFlags_Equal | ImPlotFlags_NoFrame, ImPlotAxisFlags_AutoFit, ImPlotAxisFlags_AutoFit)) {
         ImPlot::PlotImage("", (ImTextureID)r->rsen.id(), ImVec2(0, 0), ImVec2(r->ren.sensor->w, r->ren.sensor->h));
+        select_crop(r);
         work_pos = ImPlot::GetPlotPos();
         ImPlot::EndPlot();
     }
 
-    render_overlay(r->ren, ImVec2(work_pos.x + 4, work_pos.y + 4), r->pause);
+    bool denoise = r->rsen.denoise;
+    render_overlay(r->ren, ImVec2(work_pos.x + 4, work_pos.y + 4), r->pause, r->rsen.denoise);
+    // Refresh the image when paused too
+    if (denoise != r->rsen.denoise)
+        r->need_update = true;
 }
 
 static void tab_brdf_dir_light(AppData& app_data, bool& open) {
@@ -1025,6 +1126,12 @@ void drop_callback(GLFWwindow* window, int count, const char** paths)
             r->rsen.initialize();
             r->rsen.type = RenderSensor::Type::Spectrum;
             r->path = path;
+
+            // A denoiser block in the scene turns the denoising on
+            if (r->ren.denoiser) {
+                r->rsen.denoiser = *r->ren.denoiser;
+                r->rsen.denoise = true;
+            }
         }
     }
 }
@@ -0,0 +1,109 @@
+#include <lt/adaptive.h>
+
+namespace LT_NAMESPACE {
+
+Float AdaptiveSampling::pixel_error(const VarianceSensor& sensor, const uint32_t& idx)
+{
+    // Stale pixels were not rendered since the last reset
+    Float n = sensor.fresh(idx) ? sensor.count[idx] : 0.f;
+    if (n < 2)
+        return std::numeric_limits<Float>::infinity();
+
+    // Without filter the weight of a pixel is its number of samples
+    Float weight = sensor.weight[idx];
+    if (weight <= 0)
+        return std::numeric_limits<Float>::infinity();
+
+    Spectrum mean = sensor.acculumator.get(idx) / weight;
+    Spectrum var = (sensor.acculumator_sqr.get(idx) / weight - mean * mean) * (n / (n - 1));
+
+    Float m = (mean.r + mean.g + mean.b) / 3.f;
+    Float v = std::max((var.r + var.g + var.b) / 3.f, 0.f) / n;
+
+    // The small offset lets the black pixels converge
+    return std::sqrt(v) / (m + 0.001f);
+}
+
+/**
+ * @brief Sum the pixel_error() of each tile on the scheduler threads.
+ * @param error Sum of the errors of each tile, indexed by Tile::id.
+ * @param done If not empty, set to 1 for the tiles whose pixels have converged.
+ */
+static void scan_tiles(const VarianceSensor& sensor, Scheduler& scheduler, const std::vector<Tile>& tiles,
+    const uint32_t& warmup, const Float& threshold, std::vector<double>& error, std::vector<uint8_t>& done)
+{
+    scheduler.run(tiles, [&](const Tile& t, const uint32_t&) {
+        double sum = 0.;
+        bool converged = true;
+        for (uint32_t y = t.y_min; y < t.y_max; y++) {
+            for (uint32_t x = t.x_min; x < t.x_max; x++) {
+                uint32_t idx = y * sensor.w + x;
+                Float e = AdaptiveSampling::pixel_error(sensor, idx);
+                sum += e;
+                converged = converged && sensor.fresh(idx) && sensor.count[idx] >= warmup && e < threshold;
+            }
+        }
+        error[t.id] = sum;
+        if (!done.empty())
+            done[t.id] = converged;
+    });
+}
+
+/**
+ * @brief Average the tile errors over the pixels, in tile order.
+ */
+static Float average_error(const std::vector<double>& error, const size_t& pixel_count)
+{
+    double sum = 0.;
+    for (const double& e : error)
+        sum += e;
+    return pixel_count == 0 ? 0.f : Float(sum / double(pixel_count));
+}
+
+Float AdaptiveSampling::image_error(const VarianceSensor& sensor, Scheduler& scheduler)
+{
+    // Only the pixels of the crop window are rendered
+    Window window = sensor.window();
+    if (sensor.count.empty())
+        return 0.f;
+
+    const std::vector<Tile>& tiles = scheduler.tiles(window);
+    std::vector<double> error(tiles.size(), 0.);
+    std::vector<uint8_t> done;
+    scan_tiles(sensor, scheduler, tiles, 0, 0.f, error, done);
+    return average_error(error, size_t(window.width()) * size_t(window.height()));
+}
+
+Float AdaptiveSampling::image_error() const
+{
+    if (tile_error.empty())
+        return std::numeric_limits<Float>::infinity();
+    return average_error(tile_error, pixel_count);
+}
+
+uint32_t AdaptiveSampling::update(const Sensor& sensor, Scheduler& scheduler)
+{
+    Window window = sensor.window();
+    size_t n_tiles = scheduler.tiles(window).size();
+    const std::vector<Tile>& tiles = scheduler.active_tiles(window);
+
+    const VarianceSensor* vs = dynamic_cast<const VarianceSensor*>(&sensor);
+    if (!vs)
+        return tiles.size();
+
+    // The tiles are reactivated when the window changes, the converged ones keep their error
+    if (tile_error.size() != n_tiles)
+        tile_error.assign(n_tiles, std::numeric_limits<double>::infinity());
+    pixel_count = size_t(window.width()) * size_t(window.height());
+
+    std::vector<uint8_t> done(n_tiles, 0);
+    scan_tiles(*vs, scheduler, tiles, warmup, threshold, tile_error, done);
+
+    for (uint32_t id = 0; id < n_tiles; id++)
+        if (done[id])
+            scheduler.set_tile_active(id, false);
+
+    return scheduler.active_tiles(window).size();
+}
+
+} // namespace LT_NAMESPACE
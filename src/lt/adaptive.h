@@ -0,0 +1,71 @@
+/**
+ * @file
+ * @brief Definition of the AdaptiveSampling class.
+ */
+
+#pragma once
+#include <lt/lt_common.h>
+#include <lt/scheduler.h>
+#include <lt/sensor.h>
+
+namespace LT_NAMESPACE {
+
+/**
+ * @brief Stops the rendering of the tiles that have converged.
+ *
+ * After each pass, the relative error of the pixels of every active tile is
+ * estimated from the squared samples of a VarianceSensor. Once all the pixels
+ * of a tile have at least warmup samples and a relative error below the
+ * threshold, the tile is removed from the active tiles of the scheduler.
+ * The tiles are scanned on the scheduler threads, and the sum of the errors
+ * of each tile is kept for image_error().
+ */
+class AdaptiveSampling {
+public:
+    AdaptiveSampling()
+        : warmup(16)
+        , threshold(0.01)
+    {
+    }
+
+    /**
+     * @brief Relative standard error of the mean of a pixel.
+     * @param sensor The sensor accumulating the samples.
+     * @param idx Index of the pixel.
+     * @return The standard error of the mean divided by the mean, averaged over the channels.
+     */
+    static Float pixel_error(const VarianceSensor& sensor, const uint32_t& idx);
+
+    /**
+     * @brief Relative error of the whole image, scanned on the scheduler threads.
+     * @param sensor The sensor accumulating the samples.
+     * @param scheduler The scheduler dispatching the tiles.
+     * @return The pixel_error() averaged over the pixels of the crop window, infinite until every pixel has two samples.
+     */
+    static Float image_error(const VarianceSensor& sensor, Scheduler& scheduler);
+
+    /**
+     * @brief Relative error of the whole image from the tile errors of the last update().
+     * Converged tiles keep the error they had when they were deactivated.
+     * @return The pixel_error() averaged over the pixels of the crop window, infinite before the first update().
+     */
+    Float image_error() const;
+
+    /**
+     * @brief Deactivate the converged tiles of the scheduler.
+     * Does nothing if the sensor is not a VarianceSensor.
+     * @param sensor The sensor accumulating the samples.
+     * @param scheduler The scheduler dispatching the tiles.
+     * @return The number of tiles still active.
+     */
+    uint32_t update(const Sensor& sensor, Scheduler& scheduler);
+
+    uint32_t warmup; /**< Minimum number of samples per pixel before a tile can converge. */
+    Float threshold; /**< Relative error under which a pixel has converged. */
+
+private:
+    std::vector<double> tile_error; /**< Sum of the pixel_error() of each tile, indexed by Tile::id. */
+    size_t pixel_count = 0; /**< Number of pixels of the tiles. */
+};
+
+} // namespace LT_NAMESPACE
@@ -29,6 +29,11 @@ Spectrum Brdf::emission()
     return Spectrum(0.); 
 }
 
+Spectrum Brdf::reflectance(const SurfaceInteraction& si)
+{
+    return Spectrum(1.);
+}
+
 
 
 } // namespace LT_NAMESPACE
\ No newline at end of file
@@ -80,6 +80,13 @@ public:
 
     virtual Spectrum emission();
 
+    /**
+     * @brief Reflectance of the surface, used as the albedo AOV.
+     * @param si The surface interaction.
+     * @return The albedo of the surface, 1 unless overridden.
+     */
+    virtual Spectrum reflectance(const SurfaceInteraction& si);
+
 };
 
 
@@ -38,6 +38,7 @@ public:
     Spectrum eval(vec3 wi, vec3 wo, const SurfaceInteraction& si, Sampler& sampler);
     Sample sample(const vec3& wi, const SurfaceInteraction& si, Sampler& sampler);
     float pdf(const vec3& wi, const vec3& wo, const SurfaceInteraction& si);
+    Spectrum reflectance(const SurfaceInteraction& si) { return albedo->eval(si); }
 
 protected:
     void link_params() { params.add("albedo", &albedo); }
@@ -47,6 +47,10 @@ public:
         return weight * brdf1->pdf(wi, wo, si) + (1.f - weight) * brdf2->pdf(wi, wo, si);
     }
 
+    Spectrum reflectance(const SurfaceInteraction& si) {
+        return weight * brdf1->reflectance(si) + (1.f - weight) * brdf2->reflectance(si);
+    }
+
     std::shared_ptr<Brdf> brdf1;
     std::shared_ptr<Brdf> brdf2;
     Float weight;
@@ -226,6 +226,7 @@ public:
     Spectrum eval(vec3 wi, vec3 wo, const SurfaceInteraction& si, Sampler& sampler);
     Brdf::Sample sample(const vec3& wi, const SurfaceInteraction& si, Sampler& sampler);
     Float pdf(const vec3& wi, const vec3& wo, const SurfaceInteraction& si);
+    Spectrum reflectance(const SurfaceInteraction& si) { return albedo->eval(si); }
 
     std::shared_ptr<SpectrumTex> albedo;
 };
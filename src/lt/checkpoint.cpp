@@ -0,0 +1,225 @@
+#include <lt/checkpoint.h>
+#include <lt/mapped_file.h>
+
+#include <cstring>
+#include <filesystem>
+
+namespace LT_NAMESPACE {
+
+static const char checkpoint_magic[8] = { 'L', 'T', 'C', 'K', 'P', 'T', '\0', '\0' };
+static const uint32_t checkpoint_version = 4; /**< 4 : type, crop and output mode of the sensor. */
+
+/**
+ * @brief Start of a checkpoint file, followed by the sections of sensor_sections().
+ */
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t w;
+    uint32_t h;
+    uint32_t precision; /**< FilmPrecision of the accumulators. */
+    uint32_t flags; /**< Bit 0 : squared samples of a VarianceSensor, bit 1 : AOVs. */
+    uint32_t first_sample; /**< Index of the first sample of each pixel. */
+    uint32_t n_sample; /**< Index of the next sample of each pixel. */
+    uint32_t crop[4]; /**< Crop window of the sensor, all zero for the full frame. */
+    uint32_t options; /**< Bit 0 : VarianceSensor::output_variance, not checked by load_checkpoint(). */
+    char type[32]; /**< Type of the sensor, zero padded. */
+    uint64_t scene_hash;
+    uint64_t sum_counts;
+    uint64_t size; /**< Size of the file in bytes. */
+};
+
+struct CheckpointSection {
+    uint8_t* data;
+    size_t size;
+};
+
+/**
+ * @brief Size of a section in the file, sections start on 8 bytes boundaries.
+ */
+static size_t padded(const size_t& size)
+{
+    return (size + 7) & ~size_t(7);
+}
+
+static uint32_t sensor_flags(const Sensor& sensor)
+{
+    uint32_t flags = 0;
+    if (dynamic_cast<const VarianceSensor*>(&sensor))
+        flags |= 1;
+    if (!sensor.aov_albedo.empty())
+        flags |= 2;
+    return flags;
+}
+
+static std::string header_type(const CheckpointHeader& header)
+{
+    return std::string(header.type, strnlen(header.type, sizeof(header.type)));
+}
+
+/**
+ * @brief Buffers of a sensor saved in a checkpoint, in file order.
+ */
+static std::vector<CheckpointSection> sensor_sections(Sensor& sensor)
+{
+    std::vector<CheckpointSection> sections;
+    sections.push_back({ sensor.acculumator.data(), sensor.acculumator.bytes() });
+    if (VarianceSensor* vs = dynamic_cast<VarianceSensor*>(&sensor))
+        sections.push_back({ vs->acculumator_sqr.data(), vs->acculumator_sqr.bytes() });
+    sections.push_back({ (uint8_t*)sensor.weight.data(), sensor.weight.size() * sizeof(Float) });
+    sections.push_back({ (uint8_t*)sensor.count.data(), sensor.count.size() * sizeof(uint32_t) });
+    if (!sensor.aov_albedo.empty()) {
+        sections.push_back({ (uint8_t*)sensor.aov_albedo.data(), sensor.aov_albedo.size() * sizeof(Spectrum) });
+        sections.push_back({ (uint8_t*)sensor.aov_normal.data(), sensor.aov_normal.size() * sizeof(vec3) });
+        sections.push_back({ (uint8_t*)sensor.aov_depth.data(), sensor.aov_depth.size() * sizeof(Float) });
+        sections.push_back({ (uint8_t*)sensor.aov_geometry_id.data(), sensor.aov_geometry_id.size() * sizeof(int32_t) });
+    }
+    return sections;
+}
+
+bool save_checkpoint(const std::string& path, Sensor& sensor, const uint32_t& first_sample, const uint32_t& n_sample, const uint64_t& scene_hash)
+{
+    if (sensor.streamed) {
+        Log(logError) << "save_checkpoint: a streamed sensor has no samples to save";
+        return false;
+    }
+
+    // The pixels not rendered since the last reset are saved as zero
+    sensor.clear_stale();
+    std::vector<CheckpointSection> sections = sensor_sections(sensor);
+
+    if (sensor.type.size() >= sizeof(CheckpointHeader::type)) {
+        Log(logError) << "save_checkpoint: the sensor type " << sensor.type << " is too long";
+        return false;
+    }
+
+    CheckpointHeader header = {};
+    std::memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+    header.version = checkpoint_version;
+    std::memcpy(header.type, sensor.type.data(), sensor.type.size());
+    header.w = sensor.w;
+    header.h = sensor.h;
+    header.crop[0] = sensor.crop.x_min;
+    header.crop[1] = sensor.crop.y_min;
+    header.crop[2] = sensor.crop.x_max;
+    header.crop[3] = sensor.crop.y_max;
+    const VarianceSensor* vs = dynamic_cast<const VarianceSensor*>(&sensor);
+    header.options = vs && vs->output_variance ? 1 : 0;
+    header.precision = (uint32_t)sensor.precision;
+    header.flags = sensor_flags(sensor);
+    header.first_sample = first_sample;
+    header.n_sample = n_sample;
+    header.scene_hash = scene_hash;
+    header.sum_counts = sensor.sum_counts;
+    header.size = padded(sizeof(CheckpointHeader));
+    for (const CheckpointSection& s : sections)
+        header.size += padded(s.size);
+
+    std::string tmp_path = temporary_path(path);
+    bool written = false;
+    {
+        MappedFile file;
+        if (file.create(tmp_path, header.size)) {
+            uint8_t* p = file.data();
+            std::memcpy(p, &header, sizeof(CheckpointHeader));
+            p += padded(sizeof(CheckpointHeader));
+            for (const CheckpointSection& s : sections) {
+                std::memcpy(p, s.data, s.size);
+                p += padded(s.size);
+            }
+
+            written = file.flush();
+            if (!written)
+                Log(logError) << "save_checkpoint: cannot flush " << tmp_path;
+        }
+    }
+
+    std::error_code ec;
+    if (written) {
+        std::filesystem::rename(tmp_path, path, ec);
+        if (ec)
+            Log(logError) << "save_checkpoint: cannot rename " << tmp_path << " to " << path << " : " << ec.message();
+    }
+    if (!written || ec) {
+        std::filesystem::remove(tmp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Map a checkpoint file and check its header.
+ */
+static bool open_checkpoint(const std::string& path, MappedFile& file, CheckpointHeader& header)
+{
+    if (!file.open(path))
+        return false;
+
+    if (file.size() < sizeof(CheckpointHeader)) {
+        Log(logError) << "open_checkpoint: " << path << " is not a checkpoint";
+        return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(CheckpointHeader));
+
+    if (std::memcmp(header.magic, checkpoint_magic, sizeof(header.magic)) != 0 || header.version != checkpoint_version || header.size != file.size()) {
+        Log(logError) << "open_checkpoint: " << path << " is not a valid checkpoint";
+        return false;
+    }
+    return true;
+}
+
+bool read_checkpoint_info(const std::string& path, CheckpointInfo& info)
+{
+    MappedFile file;
+    CheckpointHeader header;
+    if (!open_checkpoint(path, file, header))
+        return false;
+
+    info.type = header_type(header);
+    info.w = header.w;
+    info.h = header.h;
+    info.crop = Window { header.crop[0], header.crop[1], header.crop[2], header.crop[3] };
+    info.precision = (FilmPrecision)header.precision;
+    info.variance = header.flags & 1;
+    info.aovs = header.flags & 2;
+    info.output_variance = header.options & 1;
+    info.first_sample = header.first_sample;
+    info.n_sample = header.n_sample;
+    info.scene_hash = header.scene_hash;
+    return true;
+}
+
+bool load_checkpoint(const std::string& path, Sensor& sensor, uint32_t& n_sample, const uint64_t& scene_hash)
+{
+    MappedFile file;
+    CheckpointHeader header;
+    if (!open_checkpoint(path, file, header))
+        return false;
+
+    if (header.scene_hash != scene_hash) {
+        Log(logError) << "load_checkpoint: " << path << " was saved for another scene";
+        return false;
+    }
+
+    if (sensor.streamed || header_type(header) != sensor.type || header.w != sensor.w || header.h != sensor.h
+        || header.precision != (uint32_t)sensor.precision || header.flags != sensor_flags(sensor)) {
+        Log(logError) << "load_checkpoint: " << path << " was saved for another sensor";
+        return false;
+    }
+
+    // Start from fresh pixels, all of them are overwritten
+    sensor.clear_stale();
+    std::vector<CheckpointSection> sections = sensor_sections(sensor);
+    const uint8_t* p = file.data() + padded(sizeof(CheckpointHeader));
+    for (const CheckpointSection& s : sections) {
+        std::memcpy(s.data, p, s.size);
+        p += padded(s.size);
+    }
+
+    sensor.sum_counts = header.sum_counts;
+    sensor.dirty = true;
+    n_sample = header.n_sample;
+    return true;
+}
+
+} // namespace LT_NAMESPACE
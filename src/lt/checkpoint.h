@@ -0,0 +1,67 @@
+/**
+ * @file
+ * @brief Save and restore the accumulation state of a render.
+ */
+
+#pragma once
+#include <lt/lt_common.h>
+#include <lt/sensor.h>
+
+namespace LT_NAMESPACE {
+
+/**
+ * @brief Description of a checkpoint file.
+ */
+struct CheckpointInfo {
+    std::string type; /**< Type of the sensor, see Factory<Sensor>. */
+    uint32_t w; /**< Width of the sensor. */
+    uint32_t h; /**< Height of the sensor. */
+    Window crop; /**< Crop window of the sensor, empty for the full frame. */
+    FilmPrecision precision; /**< Precision of the accumulators. */
+    bool variance; /**< True if the samples come from a VarianceSensor. */
+    bool aovs; /**< True if the AOVs are saved. */
+    bool output_variance; /**< VarianceSensor::output_variance of the sensor. */
+    uint32_t first_sample; /**< Index of the first sample of each pixel. */
+    uint32_t n_sample; /**< Index of the next sample of each pixel. */
+    uint64_t scene_hash; /**< Hash of the scene description. */
+};
+
+/**
+ * @brief Save the accumulated samples of a sensor in a checkpoint file.
+ *
+ * The file holds the moments, filter weights and counts of the pixels (and
+ * the AOVs if recorded), the index of the next sample of the integrator and
+ * a hash of the scene. It is written through a memory mapping in a temporary
+ * file renamed over the previous checkpoint once flushed to disk, so a
+ * process killed while saving leaves the previous checkpoint intact.
+ * @param path Path of the checkpoint file.
+ * @param sensor The sensor, it must not be streamed.
+ * @param first_sample Index of the first sample of each pixel, 1 unless the samples are a shard of the render.
+ * @param n_sample Index of the next sample of each pixel, see Integrator::n_sample.
+ * @param scene_hash Hash of the scene description.
+ * @return True on success.
+ */
+bool save_checkpoint(const std::string& path, Sensor& sensor, const uint32_t& first_sample, const uint32_t& n_sample, const uint64_t& scene_hash);
+
+/**
+ * @brief Read the description of a checkpoint file, without its samples.
+ * @param path Path of the checkpoint file.
+ * @param info The description to fill.
+ * @return True on success.
+ */
+bool read_checkpoint_info(const std::string& path, CheckpointInfo& info);
+
+/**
+ * @brief Restore the accumulated samples of a sensor from a checkpoint file.
+ *
+ * The sensor must have been initialized with the same type, size, precision
+ * and AOV setting as the saved one, and the scene hash must match.
+ * @param path Path of the checkpoint file.
+ * @param sensor The sensor, its samples are replaced by those of the file.
+ * @param n_sample The index of the next sample of each pixel to continue from.
+ * @param scene_hash Hash of the scene description.
+ * @return True on success, the sensor is left untouched otherwise.
+ */
+bool load_checkpoint(const std::string& path, Sensor& sensor, uint32_t& n_sample, const uint64_t& scene_hash);
+
+} // namespace LT_NAMESPACE
@@ -0,0 +1,177 @@
+#include <lt/denoiser.h>
+
+namespace LT_NAMESPACE {
+
+void Denoiser::run(const Sensor& sensor, Scheduler& scheduler, std::vector<Spectrum>& output)
+{
+    w = sensor.w;
+    h = sensor.h;
+    use_aovs = !sensor.aov_albedo.empty();
+    use_variance = dynamic_cast<const VarianceSensor*>(&sensor) != nullptr;
+
+    size_t n = size_t(w) * size_t(h);
+    for (int c = 0; c < 3; c++) {
+        color[c].resize(n);
+        albedo[c].resize(use_aovs ? n : 0);
+        normal[c].resize(use_aovs ? n : 0);
+    }
+    noise.resize(n);
+    valid.resize(n);
+    depth.resize(use_aovs ? n : 0);
+    output.resize(n);
+
+    const std::vector<Tile>& tiles = scheduler.tiles(sensor.window());
+
+    scheduler.run(tiles, [&](const Tile& t, const uint32_t& worker_id) {
+        load_features(sensor, t);
+    });
+
+    // The window of a pixel reads the features of the neighbouring tiles,
+    // they are all loaded before filtering.
+    std::vector<std::vector<float>> row_weights(scheduler.thread_count(), std::vector<float>(2 * radius + 1));
+    scheduler.run(tiles, [&](const Tile& t, const uint32_t& worker_id) {
+        filter_tile(t, output, row_weights[worker_id]);
+    });
+}
+
+void Denoiser::load_features(const Sensor& sensor, const Tile& t)
+{
+    const VarianceSensor* vs = use_variance ? static_cast<const VarianceSensor*>(&sensor) : nullptr;
+
+    for (uint32_t y = t.y_min; y < t.y_max; y++) {
+        for (uint32_t x = t.x_min; x < t.x_max; x++) {
+            uint32_t idx = y * w + x;
+
+            // Pixels not rendered since the last reset are read as empty
+            bool fresh = sensor.fresh(idx);
+            Float weight = fresh ? sensor.weight[idx] : 0.f;
+            Float n = fresh ? (Float)sensor.count[idx] : 0.f;
+            Float inv_weight = weight > 0 ? 1.f / weight : 0.f;
+            Spectrum mean = sensor.acculumator.get(idx) * inv_weight;
+
+            Spectrum var(0.);
+            if (vs && n > 1)
+                var = (vs->acculumator_sqr.get(idx) * inv_weight - mean * mean) / (n - 1);
+
+            // Demodulate the radiance by the albedo, black albedos are left as is
+            Spectrum a(1.);
+            if (use_aovs) {
+                Float inv_n = n > 0 ? 1.f / n : 0.f;
+                Spectrum alb = sensor.aov_albedo[idx] * inv_n;
+                vec3 nor = sensor.aov_normal[idx] * inv_n;
+                for (int c = 0; c < 3; c++) {
+                    a[c] = alb[c] > 0.01f ? alb[c] : 1.f;
+                    albedo[c][idx] = a[c];
+                    normal[c][idx] = nor[c];
+                }
+                depth[idx] = sensor.aov_depth[idx] * inv_n;
+            }
+
+            for (int c = 0; c < 3; c++)
+                color[c][idx] = mean[c] / a[c];
+            // Without variance, the color differences are relative to the intensity of the pixels
+            if (vs)
+                noise[idx] = std::max((var.r / (a.r * a.r) + var.g / (a.g * a.g) + var.b / (a.b * a.b)) / 3.f, 0.f);
+            else
+                noise[idx] = (color[0][idx] * color[0][idx] + color[1][idx] * color[1][idx] + color[2][idx] * color[2][idx]) / 3.f;
+            valid[idx] = n > 0 ? 1.f : 0.f;
+        }
+    }
+}
+
+void Denoiser::filter_tile(const Tile& t, std::vector<Spectrum>& output, std::vector<float>& row_weight) const
+{
+    const float inv_2_spatial = 1.f / (2.f * sigma_spatial * sigma_spatial);
+    const float inv_2_albedo = 1.f / (2.f * sigma_albedo * sigma_albedo);
+    const float inv_2_normal = 1.f / (2.f * sigma_normal * sigma_normal);
+    const float inv_2_depth = 1.f / (2.f * sigma_depth * sigma_depth);
+    const float color_scale = sigma_color * sigma_color;
+    const int r = (int)radius;
+
+    const float* cr = color[0].data();
+    const float* cg = color[1].data();
+    const float* cb = color[2].data();
+    const float* nse = noise.data();
+    const float* val = valid.data();
+
+    for (uint32_t y = t.y_min; y < t.y_max; y++) {
+        for (uint32_t x = t.x_min; x < t.x_max; x++) {
+            uint32_t p = y * w + x;
+            if (valid[p] == 0.f) {
+                output[p] = Spectrum(0.);
+                continue;
+            }
+
+            const float pr = cr[p], pg = cg[p], pb = cb[p];
+            const float p_noise = nse[p];
+
+            int x0 = std::max((int)x - r, 0);
+            int x1 = std::min((int)x + r, (int)w - 1);
+            int y0 = std::max((int)y - r, 0);
+            int y1 = std::min((int)y + r, (int)h - 1);
+            int n = x1 - x0 + 1;
+
+            float sum_w = 0.f, sum_r = 0.f, sum_g = 0.f, sum_b = 0.f;
+
+            for (int qy = y0; qy <= y1; qy++) {
+                const uint32_t row = qy * w + x0;
+                const float dy = float(qy - (int)y);
+                const float e_y = -dy * dy * inv_2_spatial;
+                float* e = row_weight.data();
+
+                // Exponent of the weight, one branchless pass per feature over contiguous planes
+                for (int k = 0; k < n; k++) {
+                    const uint32_t q = row + k;
+                    const float dx = float(x0 + k - (int)x);
+                    const float d_r = pr - cr[q];
+                    const float d_g = pg - cg[q];
+                    const float d_b = pb - cb[q];
+                    const float d_c = (d_r * d_r + d_g * d_g + d_b * d_b) / 3.f;
+                    e[k] = e_y - dx * dx * inv_2_spatial - d_c / (color_scale * (p_noise + nse[q]) + 1e-6f);
+                }
+
+                if (use_aovs) {
+                    const float* ar = albedo[0].data();
+                    const float* ag = albedo[1].data();
+                    const float* ab = albedo[2].data();
+                    const float* nx = normal[0].data();
+                    const float* ny = normal[1].data();
+                    const float* nz = normal[2].data();
+                    const float* d = depth.data();
+                    const float par = ar[p], pag = ag[p], pab = ab[p];
+                    const float pnx = nx[p], pny = ny[p], pnz = nz[p];
+                    const float pd = d[p];
+                    const float inv_pd2 = 1.f / (pd * pd + 1e-6f);
+                    for (int k = 0; k < n; k++) {
+                        const uint32_t q = row + k;
+                        const float d_ar = par - ar[q], d_ag = pag - ag[q], d_ab = pab - ab[q];
+                        const float d_nx = pnx - nx[q], d_ny = pny - ny[q], d_nz = pnz - nz[q];
+                        const float d_d = pd - d[q];
+                        const float d_a = d_ar * d_ar + d_ag * d_ag + d_ab * d_ab;
+                        const float d_n = d_nx * d_nx + d_ny * d_ny + d_nz * d_nz;
+                        e[k] -= d_a * inv_2_albedo + d_n * inv_2_normal + d_d * d_d * inv_pd2 * inv_2_depth;
+                    }
+                }
+
+                for (int k = 0; k < n; k++)
+                    e[k] = std::exp(e[k]) * val[row + k];
+
+                for (int k = 0; k < n; k++) {
+                    const uint32_t q = row + k;
+                    sum_w += e[k];
+                    sum_r += e[k] * cr[q];
+                    sum_g += e[k] * cg[q];
+                    sum_b += e[k] * cb[q];
+                }
+            }
+
+            // The center pixel has a weight of one, sum_w is never zero
+            Spectrum c = Spectrum(sum_r, sum_g, sum_b) / sum_w;
+            if (use_aovs)
+                c *= Spectrum(albedo[0][p], albedo[1][p], albedo[2][p]);
+            output[p] = c;
+        }
+    }
+}
+
+} // namespace LT_NAMESPACE
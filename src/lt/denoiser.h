@@ -0,0 +1,74 @@
+/**
+ * @file
+ * @brief Definition of the Denoiser class.
+ */
+
+#pragma once
+#include <lt/lt_common.h>
+#include <lt/scheduler.h>
+#include <lt/sensor.h>
+
+namespace LT_NAMESPACE {
+
+/**
+ * @brief Feature guided denoiser run on the pixels of a sensor.
+ *
+ * Each pixel is replaced by a weighted mean of its neighbours in a square
+ * window, a joint bilateral filter whose weights combine the distance in
+ * image space with the differences of the features of the pixels :
+ * - the albedo, shading normal and depth of the first hit, if the sensor
+ *   records the AOVs. The radiance is then divided by the albedo before
+ *   filtering and multiplied back after, so textures stay sharp ;
+ * - the color, relative to the variance of the mean of the two pixels with a
+ *   VarianceSensor (as in non-local means), relative to their intensity
+ *   otherwise.
+ *
+ * The features are copied in planes of floats so the inner loop over a row of
+ * the window runs on contiguous arrays the compiler can vectorize, and the
+ * tiles of the image are filtered in parallel by a Scheduler.
+ */
+class Denoiser {
+public:
+    Denoiser()
+        : radius(6)
+        , sigma_spatial(3.)
+        , sigma_color(8.)
+        , sigma_albedo(0.1)
+        , sigma_normal(0.3)
+        , sigma_depth(0.05)
+    {
+    }
+
+    /**
+     * @brief Denoise the mean of the samples of a sensor.
+     * @param sensor The sensor accumulating the samples, it is not modified.
+     * @param scheduler The scheduler running the tiles, it must not be rendering.
+     * @param output The denoised image, resized to the size of the sensor.
+     */
+    void run(const Sensor& sensor, Scheduler& scheduler, std::vector<Spectrum>& output);
+
+    uint32_t radius; /**< Half width of the filter window, in pixels. */
+    Float sigma_spatial; /**< Standard deviation of the spatial weight, in pixels. */
+    Float sigma_color; /**< Scale of the color differences, in standard deviations of the noise. */
+    Float sigma_albedo; /**< Standard deviation of the albedo differences. */
+    Float sigma_normal; /**< Standard deviation of the normal differences. */
+    Float sigma_depth; /**< Standard deviation of the depth differences, relative to the depth. */
+
+private:
+    void load_features(const Sensor& sensor, const Tile& t);
+    void filter_tile(const Tile& t, std::vector<Spectrum>& output, std::vector<float>& row_weight) const;
+
+    uint32_t w;
+    uint32_t h;
+    bool use_aovs; /**< True if the sensor records the AOVs. */
+    bool use_variance; /**< True if the sensor records the squared samples. */
+
+    std::vector<float> color[3]; /**< Mean of the pixels, divided by the albedo if use_aovs. */
+    std::vector<float> noise; /**< Scale of the color differences : variance of the mean with a VarianceSensor, squared intensity otherwise. */
+    std::vector<float> valid; /**< 1 for the pixels with samples, 0 otherwise. */
+    std::vector<float> albedo[3]; /**< Albedo of the first hits, 1 where it is black. */
+    std::vector<float> normal[3]; /**< Normal of the first hits. */
+    std::vector<float> depth; /**< Distance to the first hits, 0 where the camera rays escape. */
+};
+
+} // namespace LT_NAMESPACE
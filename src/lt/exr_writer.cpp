@@ -0,0 +1,322 @@
+#include <lt/exr_writer.h>
+
+#include <cstring>
+#include <filesystem>
+
+namespace LT_NAMESPACE {
+
+/////////////////////
+// Little endian encoding of the EXR fields
+///////////////////
+
+template<typename T>
+static void put(std::vector<char>& out, const T& value)
+{
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+static void put_string(std::vector<char>& out, const std::string& s)
+{
+    out.insert(out.end(), s.begin(), s.end());
+    out.push_back('\0');
+}
+
+static void put_attribute(std::vector<char>& out, const std::string& name, const std::string& type, const std::vector<char>& value)
+{
+    put_string(out, name);
+    put_string(out, type);
+    put(out, (int32_t)value.size());
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+static const int32_t exr_half = 1;
+static const int32_t exr_float = 2;
+
+/**
+ * @brief Header of an uncompressed RGB EXR, without its terminating null byte.
+ * @param out The buffer to append the header to.
+ * @param w Width of the full image, the display window.
+ * @param h Height of the full image.
+ * @param window The pixels stored in the file, the data window.
+ * @param tile_size Size of the side of the tiles, 0 for a scanline file.
+ * @param pixel_type Type of the channels, exr_half or exr_float.
+ */
+static void put_header(std::vector<char>& out, const uint32_t& w, const uint32_t& h, const Window& window, const uint32_t& tile_size, const int32_t& pixel_type = exr_float)
+{
+    put(out, (int32_t)20000630); // Magic number
+    put(out, (int32_t)(tile_size > 0 ? 2 | 0x200 : 2)); // Version 2, single part tiled or scanline file
+
+    // Channels in alphabetical order, as the pixel data
+    std::vector<char> channels;
+    for (const char* name : { "B", "G", "R" }) {
+        put_string(channels, name);
+        put(channels, pixel_type);
+        put(channels, (uint32_t)0); // pLinear and reserved
+        put(channels, (int32_t)1); // xSampling
+        put(channels, (int32_t)1); // ySampling
+    }
+    channels.push_back('\0');
+    put_attribute(out, "channels", "chlist", channels);
+
+    put_attribute(out, "compression", "compression", { 0 }); // NO_COMPRESSION
+
+    std::vector<char> data_window;
+    put(data_window, (int32_t)window.x_min);
+    put(data_window, (int32_t)window.y_min);
+    put(data_window, (int32_t)window.x_max - 1);
+    put(data_window, (int32_t)window.y_max - 1);
+    put_attribute(out, "dataWindow", "box2i", data_window);
+
+    std::vector<char> display_window;
+    put(display_window, (int32_t)0);
+    put(display_window, (int32_t)0);
+    put(display_window, (int32_t)w - 1);
+    put(display_window, (int32_t)h - 1);
+    put_attribute(out, "displayWindow", "box2i", display_window);
+
+    // RANDOM_Y : the tiles are written in completion order and found through the offset table.
+    put_attribute(out, "lineOrder", "lineOrder", { 2 });
+
+    std::vector<char> one;
+    put(one, 1.f);
+    put_attribute(out, "pixelAspectRatio", "float", one);
+    put_attribute(out, "screenWindowWidth", "float", one);
+
+    std::vector<char> center;
+    put(center, 0.f);
+    put(center, 0.f);
+    put_attribute(out, "screenWindowCenter", "v2f", center);
+
+    if (tile_size > 0) {
+        std::vector<char> tiles;
+        put(tiles, tile_size);
+        put(tiles, tile_size);
+        tiles.push_back(0); // ONE_LEVEL, ROUND_DOWN
+        put_attribute(out, "tiles", "tiledesc", tiles);
+    }
+}
+
+static bool create_parent_directory(const std::string& filename)
+{
+    namespace fs = std::filesystem;
+    fs::path d = fs::path(filename).parent_path();
+    std::error_code ec;
+    if (!d.empty() && !fs::is_directory(d))
+        fs::create_directories(d, ec);
+    return !ec;
+}
+
+
+/////////////////////
+// Scanline EXR with a data window
+///////////////////
+
+bool save_image_exr_window(const std::vector<Spectrum>& img, const uint32_t& w, const uint32_t& h, const Window& window, const std::string& filename)
+{
+    if (img.size() != size_t(w) * size_t(h) || window.width() == 0 || window.height() == 0 || window.x_max > w || window.y_max > h) {
+        Log(logError) << "save_image_exr_window: the window is not inside the " << w << "x" << h << " image";
+        return false;
+    }
+
+    create_parent_directory(filename);
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        Log(logError) << "save_image_exr_window: cannot create " << filename;
+        return false;
+    }
+
+    std::vector<char> out;
+    put_header(out, w, h, window, 0);
+    out.push_back('\0');
+
+    // One line per chunk, after the offset table
+    uint32_t line_bytes = window.width() * 3 * sizeof(float);
+    uint64_t offset = out.size() + window.height() * sizeof(uint64_t);
+    for (uint32_t y = window.y_min; y < window.y_max; y++) {
+        put(out, offset);
+        offset += 2 * sizeof(int32_t) + line_bytes;
+    }
+
+    for (uint32_t y = window.y_min; y < window.y_max; y++) {
+        put(out, (int32_t)y);
+        put(out, (int32_t)line_bytes);
+        for (int c = 2; c >= 0; c--)
+            for (uint32_t x = window.x_min; x < window.x_max; x++)
+                put(out, (float)img[y * w + x][c]);
+    }
+
+    file.write(out.data(), out.size());
+    if (!file) {
+        Log(logError) << "save_image_exr_window: cannot write " << filename;
+        return false;
+    }
+
+    Log(logHighlight) << "Saved exr file. [ " << filename << "]";
+    return true;
+}
+
+bool save_planes_exr_window(const FilmPlanes& img, const uint32_t& w, const uint32_t& h, const Window& window, const std::string& filename)
+{
+    if (img.size() != size_t(w) * size_t(h) || window.width() == 0 || window.height() == 0 || window.x_max > w || window.y_max > h) {
+        Log(logError) << "save_planes_exr_window: the window is not inside the " << w << "x" << h << " image";
+        return false;
+    }
+    if (img.precision == FilmPrecision::Double) {
+        Log(logError) << "save_planes_exr_window: double planes are not supported";
+        return false;
+    }
+
+    create_parent_directory(filename);
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        Log(logError) << "save_planes_exr_window: cannot create " << filename;
+        return false;
+    }
+
+    // Half planes are written as they are, without conversion
+    bool half = img.precision == FilmPrecision::Half;
+    size_t value_size = half ? sizeof(uint16_t) : sizeof(float);
+
+    std::vector<char> out;
+    put_header(out, w, h, window, 0, half ? exr_half : exr_float);
+    out.push_back('\0');
+
+    // One line per chunk, after the offset table
+    uint32_t line_bytes = window.width() * 3 * (uint32_t)value_size;
+    uint64_t offset = out.size() + window.height() * sizeof(uint64_t);
+    for (uint32_t y = window.y_min; y < window.y_max; y++) {
+        put(out, offset);
+        offset += 2 * sizeof(int32_t) + line_bytes;
+    }
+
+    for (uint32_t y = window.y_min; y < window.y_max; y++) {
+        put(out, (int32_t)y);
+        put(out, (int32_t)line_bytes);
+        for (int c = 2; c >= 0; c--) {
+            const char* row = half ? (const char*)(img.plane<uint16_t>(c) + y * w + window.x_min)
+                                   : (const char*)(img.plane<float>(c) + y * w + window.x_min);
+            out.insert(out.end(), row, row + window.width() * value_size);
+        }
+    }
+
+    file.write(out.data(), out.size());
+    if (!file) {
+        Log(logError) << "save_planes_exr_window: cannot write " << filename;
+        return false;
+    }
+
+    Log(logHighlight) << "Saved exr file. [ " << filename << "]";
+    return true;
+}
+
+
+/////////////////////
+// Tiled EXR writer
+///////////////////
+
+TiledExrWriter::~TiledExrWriter()
+{
+    if (file.is_open())
+        close();
+}
+
+bool TiledExrWriter::open(const std::string& filename, const uint32_t& w, const uint32_t& h, const Window& window, const uint32_t& tile_size)
+{
+    create_parent_directory(filename);
+
+    file.open(filename, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        Log(logError) << "TiledExrWriter: cannot create " << filename;
+        return false;
+    }
+
+    this->filename = filename;
+    this->window = window;
+    this->tile_size = std::max(tile_size, 1u);
+    n_tiles_x = (window.width() + this->tile_size - 1) / this->tile_size;
+    uint32_t n_tiles_y = (window.height() + this->tile_size - 1) / this->tile_size;
+    offsets.assign(size_t(n_tiles_x) * n_tiles_y, 0);
+
+    std::vector<char> header;
+    put_header(header, w, h, window, this->tile_size);
+    header.push_back('\0');
+
+    // Room for the offset table, filled by close()
+    table_offset = header.size();
+    header.resize(header.size() + offsets.size() * sizeof(uint64_t), 0);
+
+    file.write(header.data(), header.size());
+    if (!file) {
+        Log(logError) << "TiledExrWriter: cannot write the header of " << filename;
+        return false;
+    }
+    return true;
+}
+
+bool TiledExrWriter::write_tile(const Tile& t, const FilmTile& film)
+{
+    uint32_t tw = t.x_max - t.x_min;
+    uint32_t th = t.y_max - t.y_min;
+
+    // Chunk header then, for each line, the B, G and R values of its pixels
+    std::vector<char> chunk;
+    chunk.reserve(5 * sizeof(int32_t) + size_t(tw) * th * 3 * sizeof(float));
+    uint32_t tx = (t.x_min - window.x_min) / tile_size;
+    uint32_t ty = (t.y_min - window.y_min) / tile_size;
+    put(chunk, (int32_t)tx);
+    put(chunk, (int32_t)ty);
+    put(chunk, (int32_t)0); // Level
+    put(chunk, (int32_t)0);
+    put(chunk, (int32_t)(size_t(tw) * th * 3 * sizeof(float)));
+
+    for (uint32_t y = t.y_min; y < t.y_max; y++) {
+        for (int c = 2; c >= 0; c--) {
+            for (uint32_t x = t.x_min; x < t.x_max; x++) {
+                uint32_t f_idx = (y - film.tile.y_min) * film.w + (x - film.tile.x_min);
+                Float weight = film.weight[f_idx];
+                put(chunk, (float)(weight > 0 ? film.sum[f_idx][c] / weight : 0.f));
+            }
+        }
+    }
+
+    uint32_t idx = ty * n_tiles_x + tx;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file.is_open() || idx >= offsets.size())
+        return false;
+
+    offsets[idx] = (uint64_t)file.tellp();
+    file.write(chunk.data(), chunk.size());
+    if (!file) {
+        Log(logError) << "TiledExrWriter: cannot write a tile of " << filename;
+        return false;
+    }
+    return true;
+}
+
+bool TiledExrWriter::close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file.is_open())
+        return false;
+
+    std::vector<char> table;
+    for (const uint64_t& offset : offsets)
+        put(table, offset);
+
+    file.seekp(table_offset);
+    file.write(table.data(), table.size());
+    file.close();
+
+    if (!file) {
+        Log(logError) << "TiledExrWriter: cannot write the offset table of " << filename;
+        return false;
+    }
+
+    Log(logHighlight) << "Saved exr file. [ " << filename << "]";
+    return true;
+}
+
+} // namespace LT_NAMESPACE
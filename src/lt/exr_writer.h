@@ -0,0 +1,105 @@
+/**
+ * @file
+ * @brief Definition of the TiledExrWriter class streaming tiles of pixels to an EXR file.
+ */
+
+#pragma once
+#include <lt/lt_common.h>
+#include <lt/scheduler.h>
+#include <lt/sensor.h>
+
+#include <fstream>
+#include <mutex>
+
+namespace LT_NAMESPACE {
+
+/**
+ * @brief Save a window of a RGB image in an uncompressed scanline EXR.
+ * Only the pixels of the window are stored, as the data window of the file,
+ * the display window is the full image.
+ * @param img The pixels of the full image, row by row.
+ * @param w Width of the image.
+ * @param h Height of the image.
+ * @param window The pixels to save.
+ * @param filename Path of the EXR file, its directory is created if needed.
+ * @return True on success.
+ */
+bool save_image_exr_window(const std::vector<Spectrum>& img, const uint32_t& w, const uint32_t& h, const Window& window, const std::string& filename);
+
+/**
+ * @brief Save a window of a RGB image stored in planes in an uncompressed scanline EXR.
+ * Half planes are saved as half channels, float planes as float channels.
+ * @param img The planes of the full image, half or float.
+ * @param w Width of the image.
+ * @param h Height of the image.
+ * @param window The pixels to save.
+ * @param filename Path of the EXR file, its directory is created if needed.
+ * @return True on success.
+ */
+bool save_planes_exr_window(const FilmPlanes& img, const uint32_t& w, const uint32_t& h, const Window& window, const std::string& filename);
+
+/**
+ * @brief Writes an uncompressed tiled RGB EXR one tile at a time.
+ *
+ * The header and an empty offset table are written by open(), each tile is
+ * then appended to the file as soon as it is given to write_tile(), in any
+ * order, and the offset table is filled by close(). Only the tile being
+ * written is held in memory, so the size of the image is not bound by the RAM.
+ *
+ * The tiles of the file are those of generate_tiles() with the same window
+ * and tile size, Tile::id is their index in the offset table. The window is
+ * the data window of the file, the display window is the full image.
+ */
+class TiledExrWriter {
+public:
+    TiledExrWriter()
+        : window { 0, 0, 0, 0 }
+        , tile_size(0)
+        , n_tiles_x(0)
+        , table_offset(0)
+    {
+    }
+
+    ~TiledExrWriter();
+
+    /**
+     * @brief Create the file and write its header.
+     * @param filename Path of the EXR file, its directory is created if needed.
+     * @param w Width of the image.
+     * @param h Height of the image.
+     * @param window The pixels written, see Sensor::window().
+     * @param tile_size Size of the side of a tile in pixels.
+     * @return True on success.
+     */
+    bool open(const std::string& filename, const uint32_t& w, const uint32_t& h, const Window& window, const uint32_t& tile_size);
+
+    /**
+     * @brief Append the pixels of a finished tile to the file.
+     * Can be called concurrently from several threads.
+     * @param t The tile, from generate_tiles() with the window and tile size given to open().
+     * @param film The tile buffer holding the samples of the tile, the pixels
+     * written are the mean of their samples.
+     * @return True on success.
+     */
+    bool write_tile(const Tile& t, const FilmTile& film);
+
+    /**
+     * @brief Write the offset table and close the file.
+     * Tiles never written are left out of the table, readers see them as missing.
+     * @return True on success.
+     */
+    bool close();
+
+private:
+    std::string filename;
+    std::ofstream file;
+    std::mutex mutex;
+
+    Window window;
+    uint32_t tile_size;
+    uint32_t n_tiles_x;
+    uint64_t table_offset; /**< Position of the offset table in the file. */
+    std::vector<uint64_t> offsets; /**< Position of each tile chunk in the file, 0 until written. */
+};
+
+} // namespace LT_NAMESPACE
@@ -0,0 +1,44 @@
+#include <lt/film.h>
+
+#include <map>
+
+namespace LT_NAMESPACE {
+
+bool film_precision_from_string(const std::string& name, FilmPrecision& precision)
+{
+    static const std::map<std::string, FilmPrecision> precisions {
+        { "half"  , FilmPrecision::Half   },
+        { "float" , FilmPrecision::Float  },
+        { "double", FilmPrecision::Double }
+    };
+
+    auto it = precisions.find(name);
+    if (it == precisions.end()) {
+        Log(logError) << "film_precision_from_string: unknown film precision \"" << name << "\"";
+        return false;
+    }
+    precision = it->second;
+    return true;
+}
+
+void FilmPlanes::init(const size_t& size, const FilmPrecision& p)
+{
+    precision = p;
+    n = size;
+
+    size_t value_size = precision == FilmPrecision::Half ? sizeof(uint16_t)
+        : precision == FilmPrecision::Double             ? sizeof(double)
+                                                         : sizeof(float);
+    size_t bytes = 3 * n * value_size;
+
+    storage.assign((bytes + sizeof(uint64_t) - 1) / sizeof(uint64_t), 0);
+    storage.shrink_to_fit();
+}
+
+void FilmPlanes::reset()
+{
+    // Zero is +0 in the three precisions
+    std::fill(storage.begin(), storage.end(), 0);
+}
+
+} // namespace LT_NAMESPACE
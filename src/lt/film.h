@@ -0,0 +1,265 @@
+/**
+ * @file
+ * @brief Definition of the FilmPlanes class storing the accumulated samples of a sensor.
+ */
+
+#pragma once
+#include <lt/lt_common.h>
+
+#include <cassert>
+#include <cstring>
+
+namespace LT_NAMESPACE {
+
+/**
+ * @brief Precision of the buffers of a sensor.
+ *
+ * The sums of the samples are never kept in 16 bit floats : they would lose
+ * precision after a few thousand samples and overflow past 65504.
+ */
+enum class FilmPrecision {
+    Half, /**< 32 bit float sums, the resolved values in 16 bit floats, for previews. */
+    Float, /**< 32 bit floats. */
+    Double /**< 64 bit float sums, for long reference renders, the resolved values in 32 bit floats. */
+};
+
+/**
+ * @brief Precision of the sums of the samples of a sensor : float or double.
+ */
+inline FilmPrecision accumulator_precision(const FilmPrecision& precision)
+{
+    return precision == FilmPrecision::Double ? FilmPrecision::Double : FilmPrecision::Float;
+}
+
+/**
+ * @brief Precision of the resolved values of a sensor : half or float.
+ */
+inline FilmPrecision value_precision(const FilmPrecision& precision)
+{
+    return precision == FilmPrecision::Half ? FilmPrecision::Half : FilmPrecision::Float;
+}
+
+/**
+ * @brief Convert a precision name ("half", "float" or "double") to a FilmPrecision.
+ * @param name The name of the precision.
+ * @param precision The precision to fill, unchanged if the name is unknown.
+ * @return True if the name is a valid precision.
+ */
+bool film_precision_from_string(const std::string& name, FilmPrecision& precision);
+
+/**
+ * @brief Convert a float to the nearest 16 bit float (IEEE 754 binary16).
+ */
+inline uint16_t float_to_half(const float& f)
+{
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t f_exp = (x >> 23) & 0xff;
+    uint32_t mant = x & 0x7fffff;
+
+    // Inf and NaN
+    if (f_exp == 0xff)
+        return sign | 0x7c00 | (mant ? 0x200 : 0);
+
+    int32_t exp = int32_t(f_exp) - 127 + 15;
+    if (exp >= 31)
+        return sign | 0x7c00;
+
+    // Subnormal halfs, rounded to nearest even
+    if (exp <= 0) {
+        if (exp < -10)
+            return sign;
+        mant |= 0x800000;
+        uint32_t shift = 14 - exp;
+        uint32_t h = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (h & 1)))
+            h++;
+        return sign | h;
+    }
+
+    // Normal halfs, rounded to nearest even (a carry may round up to inf)
+    uint32_t h = (uint32_t(exp) << 10) | (mant >> 13);
+    uint32_t rem = mant & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+        h++;
+    return sign | h;
+}
+
+/**
+ * @brief Convert a 16 bit float (IEEE 754 binary16) to a float.
+ */
+inline float half_to_float(const uint16_t& h)
+{
+    uint32_t sign = uint32_t(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+
+    uint32_t x;
+    if (exp == 0) {
+        if (mant == 0) {
+            x = sign;
+        } else {
+            // Subnormal, normalize the mantissa
+            exp = 127 - 15 + 1;
+            while (!(mant & 0x400)) {
+                mant <<= 1;
+                exp--;
+            }
+            x = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+        }
+    } else if (exp == 31) {
+        x = sign | 0x7f800000 | (mant << 13);
+    } else {
+        x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+    }
+
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+/**
+ * @brief RGB buffer of per pixel values with a selectable precision.
+ *
+ * The three channels are stored in separate planes (SoA layout), each of them
+ * a contiguous array of half, float or double values. Half planes only store
+ * values, they are never summed into, see add().
+ */
+class FilmPlanes {
+public:
+    FilmPlanes()
+        : precision(FilmPrecision::Float)
+        , n(0)
+    {
+    }
+
+    /**
+     * @brief Allocate the planes and clear them.
+     * @param size Number of pixels.
+     * @param p Precision of the values.
+     */
+    void init(const size_t& size, const FilmPrecision& p);
+
+    /**
+     * @brief Set all the values to zero.
+     */
+    void reset();
+
+    /**
+     * @brief Number of pixels of the buffer.
+     */
+    size_t size() const { return n; }
+
+    /**
+     * @brief Memory used by the buffer in bytes.
+     */
+    size_t bytes() const { return storage.size() * sizeof(uint64_t); }
+
+    /**
+     * @brief Value of a pixel.
+     */
+    Spectrum get(const size_t& idx) const
+    {
+        switch (precision) {
+        case FilmPrecision::Half: {
+            const uint16_t* p = plane<uint16_t>();
+            return Spectrum(half_to_float(p[idx]), half_to_float(p[n + idx]), half_to_float(p[2 * n + idx]));
+        }
+        case FilmPrecision::Double: {
+            const double* p = plane<double>();
+            return Spectrum(Float(p[idx]), Float(p[n + idx]), Float(p[2 * n + idx]));
+        }
+        case FilmPrecision::Float:
+        default: {
+            const float* p = plane<float>();
+            return Spectrum(p[idx], p[n + idx], p[2 * n + idx]);
+        }
+        }
+    }
+
+    /**
+     * @brief Set the value of a pixel.
+     */
+    void set(const size_t& idx, const Spectrum& s)
+    {
+        switch (precision) {
+        case FilmPrecision::Half: {
+            uint16_t* p = plane<uint16_t>();
+            p[idx] = float_to_half(s.x);
+            p[n + idx] = float_to_half(s.y);
+            p[2 * n + idx] = float_to_half(s.z);
+            break;
+        }
+        case FilmPrecision::Double: {
+            double* p = plane<double>();
+            p[idx] = s.x;
+            p[n + idx] = s.y;
+            p[2 * n + idx] = s.z;
+            break;
+        }
+        case FilmPrecision::Float:
+        default: {
+            float* p = plane<float>();
+            p[idx] = s.x;
+            p[n + idx] = s.y;
+            p[2 * n + idx] = s.z;
+            break;
+        }
+        }
+    }
+
+    /**
+     * @brief Add a value to a pixel, the sum is computed in the precision of the buffer.
+     * Only for float and double buffers.
+     */
+    void add(const size_t& idx, const Spectrum& s)
+    {
+        assert(precision != FilmPrecision::Half);
+        switch (precision) {
+        case FilmPrecision::Double: {
+            double* p = plane<double>();
+            p[idx] += s.x;
+            p[n + idx] += s.y;
+            p[2 * n + idx] += s.z;
+            break;
+        }
+        case FilmPrecision::Float:
+        default: {
+            float* p = plane<float>();
+            p[idx] += s.x;
+            p[n + idx] += s.y;
+            p[2 * n + idx] += s.z;
+            break;
+        }
+        }
+    }
+
+    /**
+     * @brief Raw bytes of the planes, bytes() long, to save and restore the buffer.
+     */
+    uint8_t* data() { return reinterpret_cast<uint8_t*>(storage.data()); }
+    const uint8_t* data() const { return reinterpret_cast<const uint8_t*>(storage.data()); }
+
+    /**
+     * @brief First value of a channel, T must match the precision : uint16_t
+     * for half, float or double.
+     * @param c The channel, 0 to 2.
+     */
+    template<typename T>
+    T* plane(const size_t& c = 0) { return reinterpret_cast<T*>(storage.data()) + c * n; }
+
+    template<typename T>
+    const T* plane(const size_t& c = 0) const { return reinterpret_cast<const T*>(storage.data()) + c * n; }
+
+    FilmPrecision precision; /**< Precision of the values, set by init(). */
+
+private:
+    size_t n; /**< Number of pixels. */
+    std::vector<uint64_t> storage; /**< The three planes one after the other, 8 byte aligned for the doubles. */
+};
+
+} // namespace LT_NAMESPACE
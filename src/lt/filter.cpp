@@ -0,0 +1,48 @@
+#include <lt/filter.h>
+
+namespace LT_NAMESPACE {
+
+/////////////////////
+// Filter Factory
+///////////////////
+
+template<>
+Factory<Filter>::CreatorRegistry& Factory<Filter>::registry()
+{
+    static Factory<Filter>::CreatorRegistry registry {
+        { "BoxFilter"           , std::make_shared<BoxFilter>            },
+        { "GaussianFilter"      , std::make_shared<GaussianFilter>       },
+        { "MitchellFilter"      , std::make_shared<MitchellFilter>       },
+        { "BlackmanHarrisFilter", std::make_shared<BlackmanHarrisFilter> }
+    };
+    return registry;
+}
+
+Float GaussianFilter::eval_1d(const Float& x) const
+{
+    Float inv_2_sigma2 = 1. / (2. * sigma * sigma);
+    return std::max((Float)0., std::exp(-x * x * inv_2_sigma2) - std::exp(-radius * radius * inv_2_sigma2));
+}
+
+Float MitchellFilter::eval_1d(const Float& x) const
+{
+    // The cubic is defined on [-2, 2]
+    Float t = std::abs(2. * x / radius);
+    if (t > 1.)
+        return ((-b - 6. * c) * t * t * t + (6. * b + 30. * c) * t * t + (-12. * b - 48. * c) * t + (8. * b + 24. * c)) / 6.;
+    return ((12. - 9. * b - 6. * c) * t * t * t + (-18. + 12. * b + 6. * c) * t * t + (6. - 2. * b)) / 6.;
+}
+
+Float BlackmanHarrisFilter::eval_1d(const Float& x) const
+{
+    const Float a0 = 0.35875;
+    const Float a1 = 0.48829;
+    const Float a2 = 0.14128;
+    const Float a3 = 0.01168;
+
+    // Window over [-radius, radius], maximal at the center
+    Float t = 2. * pi * (x / (2. * radius) + 0.5);
+    return a0 - a1 * std::cos(t) + a2 * std::cos(2. * t) - a3 * std::cos(3. * t);
+}
+
+} // namespace LT_NAMESPACE
@@ -0,0 +1,148 @@
+/**
+ * @file
+ * @brief Definitions of the pixel reconstruction filters.
+ */
+
+#pragma once
+
+#include <lt/factory.h>
+#include <lt/lt_common.h>
+#include <lt/serialize.h>
+
+namespace LT_NAMESPACE {
+
+/**
+ * @brief Abstract base class for pixel reconstruction filters.
+ *
+ * A sample taken at the position p of the image contributes to every pixel
+ * whose center c is closer than radius on both axes, with the weight
+ * eval(p - c). The filters are separable, offsets are given in pixels.
+ */
+class Filter : public Serializable {
+public:
+    /**
+     * @brief Constructor for Filter.
+     * @param type The type of filter.
+     * @param r The default radius of the filter, in pixels.
+     */
+    Filter(const std::string& type, const Float& r)
+        : Serializable(type)
+        , radius(r)
+    {
+        params.add("radius", &radius);
+    }
+
+    /**
+     * @brief Weight of a sample.
+     * @param offset Offset from the pixel center to the sample, in pixels.
+     * @return The weight of the sample, zero outside the radius.
+     */
+    Float eval(const vec2& offset) const
+    {
+        if (std::abs(offset.x) > radius || std::abs(offset.y) > radius)
+            return 0.;
+        return eval_1d(offset.x) * eval_1d(offset.y);
+    }
+
+    /**
+     * @brief Number of pixels a sample can reach outside of its own pixel.
+     * Samples are taken inside their pixel, so a tile buffer needs this
+     * many pixels of guard band on each side.
+     */
+    uint32_t guard_band() const
+    {
+        return (uint32_t)std::ceil(std::max(radius - (Float)0.5, (Float)0.));
+    }
+
+    Float radius; /**< Half width of the support of the filter, in pixels. */
+
+protected:
+    /**
+     * @brief One dimensional profile of the filter.
+     * @param x Offset in pixels, in [-radius, radius].
+     */
+    virtual Float eval_1d(const Float& x) const = 0;
+
+    void link_params() { }
+};
+
+/**
+ * @brief Box filter, every sample has the same weight.
+ */
+class BoxFilter : public Filter {
+public:
+    BoxFilter()
+        : Filter("BoxFilter", 0.5)
+    {
+        link_params();
+    }
+
+protected:
+    Float eval_1d(const Float& x) const { return 1.; }
+};
+
+/**
+ * @brief Gaussian filter, shifted to reach zero at the radius.
+ */
+class GaussianFilter : public Filter {
+public:
+    GaussianFilter()
+        : Filter("GaussianFilter", 1.5)
+        , sigma(0.5)
+    {
+        link_params();
+    }
+
+    Float sigma; /**< Standard deviation of the gaussian, in pixels. */
+
+protected:
+    Float eval_1d(const Float& x) const;
+
+    void link_params()
+    {
+        params.add("sigma", &sigma);
+    }
+};
+
+/**
+ * @brief Mitchell-Netravali cubic filter.
+ */
+class MitchellFilter : public Filter {
+public:
+    MitchellFilter()
+        : Filter("MitchellFilter", 2.)
+        , b(1. / 3.)
+        , c(1. / 3.)
+    {
+        link_params();
+    }
+
+    Float b; /**< B parameter of the cubic. */
+    Float c; /**< C parameter of the cubic. */
+
+protected:
+    Float eval_1d(const Float& x) const;
+
+    void link_params()
+    {
+        params.add("b", &b);
+        params.add("c", &c);
+    }
+};
+
+/**
+ * @brief Four terms Blackman-Harris window.
+ */
+class BlackmanHarrisFilter : public Filter {
+public:
+    BlackmanHarrisFilter()
+        : Filter("BlackmanHarrisFilter", 1.5)
+    {
+        link_params();
+    }
+
+protected:
+    Float eval_1d(const Float& x) const;
+};
+
+} // namespace LT_NAMESPACE
@@ -1,4 +1,9 @@
 #include <lt/geometry.h>
+#include <lt/mesh_cache.h>
+
+#include <atomic>
+#include <functional>
+#include <thread>
 
 namespace LT_NAMESPACE {
 
@@ -7,10 +12,173 @@ Factory<Geometry>::CreatorRegistry& Factory<Geometry>::registry()
 {
     static Factory<Geometry>::CreatorRegistry registry {
           { "Mesh", std::make_shared<Mesh> }
+        , { "Instance", std::make_shared<Instance> }
         , { "Rectangle", std::make_shared<Rectangle> }
         , { "Sphere", std::make_shared<Sphere> }
     };
     return registry;
 }
 
+/////////////////////
+// Mesh
+///////////////////
+
+void Mesh::init()
+{
+    uint64_t key;
+    if (!cache || !mesh_cache_key(filename, local_to_world, key)) {
+        load_obj();
+        return;
+    }
+
+    std::string cache_path = mesh_cache_path(filename, local_to_world);
+    if (load_mesh_cache(cache_path, key, *this)) {
+        Log(logInfo) << "Mesh: loaded " << cache_path;
+        return;
+    }
+
+    if (load_obj() && !save_mesh_cache(cache_path, key, *this))
+        Log(logWarning) << "Mesh: cannot save the cache " << cache_path;
+}
+
+/**
+ * @brief Run fn(begin, end, chunk) over n_chunks contiguous chunks of [0, n), one thread per chunk.
+ */
+static void parallel_chunks(const size_t& n, const uint32_t& n_chunks, const std::function<void(const size_t&, const size_t&, const uint32_t&)>& fn)
+{
+    if (n_chunks == 1) {
+        fn(0, n, 0);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(n_chunks);
+    for (uint32_t k = 0; k < n_chunks; k++)
+        threads.emplace_back(fn, n * k / n_chunks, n * (k + 1) / n_chunks, k);
+    for (auto& t : threads)
+        t.join();
+}
+
+static uint64_t corner_hash(const fastObjIndex& c)
+{
+    // splitmix64 finalizer of the packed indices
+    uint64_t h = ((uint64_t(c.p) << 32) | c.t) ^ (uint64_t(c.n) * 0x9e3779b97f4a7c15ull);
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
+
+static bool same_corner(const fastObjIndex& a, const fastObjIndex& b)
+{
+    return a.p == b.p && a.t == b.t && a.n == b.n;
+}
+
+bool Mesh::load_obj()
+{
+    // Parse obj
+    fastObjMesh* fobj = fast_obj_read(filename.c_str());
+    if (!fobj) {
+        Log(logError) << "Could not read : " << filename;
+        return false;
+    }
+
+    glm::mat4 inv_tra_local_to_world = glm::inverse(glm::transpose(local_to_world));
+
+    // The faces are triangles, each corner is a (position, uv, normal) triple
+    const fastObjIndex* corners = fobj->indices;
+    const size_t n_corners = size_t(3) * fobj->face_count;
+    const uint32_t n_chunks = n_corners < 65536 ? 1 : std::max(1u, std::thread::hardware_concurrency());
+
+    // Open addressing table of the corners, at most two thirds full.
+    // Each slot holds the smallest corner with its key, so the vertices are
+    // numbered in order of first occurrence whatever the thread interleaving.
+    const uint32_t empty = UINT32_MAX;
+    size_t table_size = 1;
+    while (table_size < n_corners + n_corners / 2 + 1)
+        table_size <<= 1;
+    const size_t mask = table_size - 1;
+    std::unique_ptr<std::atomic<uint32_t>[]> table(new std::atomic<uint32_t>[table_size]);
+    parallel_chunks(table_size, n_chunks, [&](const size_t& begin, const size_t& end, const uint32_t&) {
+        for (size_t i = begin; i < end; i++)
+            table[i].store(empty, std::memory_order_relaxed);
+    });
+
+    // Slot of each corner, then index of its vertex
+    std::vector<uint32_t> corner_slot(n_corners);
+    parallel_chunks(n_corners, n_chunks, [&](const size_t& begin, const size_t& end, const uint32_t&) {
+        for (size_t c = begin; c < end; c++) {
+            size_t h = corner_hash(corners[c]) & mask;
+            uint32_t s = table[h].load(std::memory_order_relaxed);
+            while (true) {
+                if (s == empty) {
+                    if (table[h].compare_exchange_weak(s, (uint32_t)c, std::memory_order_relaxed))
+                        break;
+                    continue;
+                }
+                if (same_corner(corners[s], corners[c])) {
+                    while (c < s && !table[h].compare_exchange_weak(s, (uint32_t)c, std::memory_order_relaxed)) { }
+                    break;
+                }
+                h = (h + 1) & mask;
+                s = table[h].load(std::memory_order_relaxed);
+            }
+            corner_slot[c] = (uint32_t)h;
+        }
+    });
+
+    // Number the first occurrences, chunk by chunk
+    std::vector<uint32_t> chunk_offset(n_chunks + 1, 0);
+    parallel_chunks(n_corners, n_chunks, [&](const size_t& begin, const size_t& end, const uint32_t& k) {
+        uint32_t count = 0;
+        for (size_t c = begin; c < end; c++)
+            count += table[corner_slot[c]].load(std::memory_order_relaxed) == c;
+        chunk_offset[k + 1] = count;
+    });
+    for (uint32_t k = 0; k < n_chunks; k++)
+        chunk_offset[k + 1] += chunk_offset[k];
+
+    std::vector<uint32_t> corner_vertex(n_corners);
+    parallel_chunks(n_corners, n_chunks, [&](const size_t& begin, const size_t& end, const uint32_t& k) {
+        uint32_t index = chunk_offset[k];
+        for (size_t c = begin; c < end; c++)
+            if (table[corner_slot[c]].load(std::memory_order_relaxed) == c)
+                corner_vertex[c] = index++;
+    });
+
+    // Fill the preallocated attributes and indices
+    const size_t n_vertex = chunk_offset[n_chunks];
+    vertex.resize(n_vertex);
+    normal.resize(n_vertex);
+    uv.resize(n_vertex);
+    triangle_indices.resize(fobj->face_count);
+
+    parallel_chunks(n_corners, n_chunks, [&](const size_t& begin, const size_t& end, const uint32_t&) {
+        for (size_t c = begin; c < end; c++) {
+            uint32_t first = table[corner_slot[c]].load(std::memory_order_relaxed);
+            uint32_t index = corner_vertex[first];
+            triangle_indices[c / 3][c % 3] = index;
+            if (first != c)
+                continue;
+
+            uint32_t iv = corners[c].p;
+            uint32_t in = corners[c].n;
+            uint32_t it = corners[c].t;
+            glm::vec4 local_vertex = glm::vec4(fobj->positions[3 * iv],
+                fobj->positions[3 * iv + 1],
+                fobj->positions[3 * iv + 2],
+                1);
+            glm::vec4 local_normal = glm::vec4(fobj->normals[3 * in],
+                fobj->normals[3 * in + 1],
+                fobj->normals[3 * in + 2],
+                0);
+            vertex[index] = vec3(local_to_world * local_vertex);
+            normal[index] = vec3(inv_tra_local_to_world * local_normal);
+            uv[index] = vec2(fobj->texcoords[2 * it], fobj->texcoords[2 * it + 1]);
+        }
+    });
+
+    fast_obj_destroy(fobj);
+    return true;
+}
+
 } // namespace LT_NAMESPACE
@@ -8,9 +8,12 @@
 #include <embree3/rtcore.h>
 #include <fast_obj/fast_obj.h>
 #include <lt/brdf_common.h>
+#include <lt/geometry_buffer.h>
 #include <lt/lt_common.h>
 #include <lt/ray.h>
 
+#include <optional>
+
 namespace LT_NAMESPACE {
 
 /**
@@ -56,6 +59,8 @@ public:
     int rtc_id;
     glm::mat4 local_to_world;
 
+    std::optional<RTCBuildQuality> build_quality; /**< Build quality of the geometry, the one of the scene if unset. */
+
 };
 
 /**
@@ -86,30 +91,24 @@ public:
 
     /**
      * @brief Initialize the Embree RTC geometry for the mesh.
+     * Embree reads the vertices and indices in place, they must not change
+     * while the geometry is in use.
      * @param device The Embree RTC device.
      */
     void init_rtc(RTCDevice device)
     {
+        static_assert(sizeof(vec3) == 3 * sizeof(float) && sizeof(glm::uvec3) == 3 * sizeof(unsigned),
+            "The vertices and indices are shared with Embree as FLOAT3 and UINT3");
+
         rtc_geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE);
 
-        float* vb = (float*)rtcSetNewGeometryBuffer(
+        rtcSetSharedGeometryBuffer(
             rtc_geom, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3,
-            3 * sizeof(float), vertex.size());
-        for (int i = 0; i < vertex.size(); i++) {
-            vb[3 * i] = vertex[i].x;
-            vb[3 * i + 1] = vertex[i].y;
-            vb[3 * i + 2] = vertex[i].z;
-        }
+            vertex.data(), 0, sizeof(vec3), vertex.size());
 
-        unsigned* ib = (unsigned*)rtcSetNewGeometryBuffer(
+        rtcSetSharedGeometryBuffer(
             rtc_geom, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3,
-            3 * sizeof(unsigned), triangle_indices.size());
-        for (int i = 0; i < triangle_indices.size(); i++) {
-            ib[3 * i] = triangle_indices[i].x;
-            ib[3 * i + 1] = triangle_indices[i].y;
-            ib[3 * i + 2] = triangle_indices[i].z;
-        }
-
+            triangle_indices.data(), 0, sizeof(glm::uvec3), triangle_indices.size());
     }
 
     /**
@@ -143,10 +142,10 @@ public:
         return uv2 * rayhit.hit.u + uv3 * rayhit.hit.v + uv1 * (1 - rayhit.hit.u - rayhit.hit.v);
     }
     
-    std::vector<vec3> normal; /**< Vertex normals. */
-    std::vector<vec3> vertex; /**< Vertex positions. */
-    std::vector<glm::uvec3> triangle_indices; /**< Indices of triangle vertices. */
-    std::vector<vec2> uv; /**< Vertex UV. */
+    GeometryBuffer<vec3> normal; /**< Vertex normals. */
+    GeometryBuffer<vec3> vertex; /**< Vertex positions, shared with Embree. */
+    GeometryBuffer<glm::uvec3> triangle_indices; /**< Indices of triangle vertices, shared with Embree. */
+    GeometryBuffer<vec2> uv; /**< Vertex UV. */
 
 };
 
@@ -161,64 +160,29 @@ public:
      */
     Mesh()
         : TriangleMesh("Mesh")
+        , cache(true)
     {
         link_params();
     };
 
     /**
-     * @brief Initialize the mesh geometry by parsing an OBJ file.
+     * @brief Initialize the mesh geometry from its cache, or by parsing the OBJ file.
+     * A parsed mesh is saved in the cache for the next runs, see mesh_cache.h.
      */
-    void init()
-    {
-        // Parse obj
-        fastObjMesh* fobj = fast_obj_read(filename.c_str());
-        if (!fobj) {
-            Log(logError) << "Could not read : " << filename;
-            return;
-        }
+    void init();
 
-        glm::mat4 inv_tra_local_to_world = glm::inverse(glm::transpose(local_to_world));
-
-        std::map<std::pair<uint32_t, uint32_t>, uint32_t> exist;
-        for (int i = 0; i < fobj->face_count; i++) {
-            glm::uvec3 idx;
-
-            for (int j = 0; j < 3; j++) {
-                int iv = fobj->indices[3 * i + j].p;
-                int in = fobj->indices[3 * i + j].n;
-                int it = fobj->indices[3 * i + j].t;
-
-                std::map<std::pair<uint32_t, uint32_t>, uint32_t>::iterator iter = exist.find({ iv, in });
-                if (iter != exist.end()) {
-                    idx[j] = iter->second;
-                }
-                else {
-                    idx[j] = vertex.size();
-                    exist[{ iv, in }] = vertex.size();
-                    glm::vec4 local_vertex = glm::vec4(fobj->positions[3 * iv],
-                        fobj->positions[3 * iv + 1],
-                        fobj->positions[3 * iv + 2],
-                        1);
-                    glm::vec4 local_normal = glm::vec4(fobj->normals[3 * in],
-                        fobj->normals[3 * in + 1],
-                        fobj->normals[3 * in + 2],
-                        0);
-                    vertex.push_back(vec3(local_to_world * local_vertex));
-                    normal.push_back(vec3(inv_tra_local_to_world * local_normal));
-
-                    uv.push_back(vec2(fobj->texcoords[2 * it], fobj->texcoords[2 * it + 1]));
-                }
-            }
-
-            triangle_indices.push_back(idx);
-        }
-
-        fast_obj_destroy(fobj);
-    };
+    /**
+     * @brief Parse the OBJ file and deduplicate its vertices, transformed to world space.
+     * Corners sharing their position, uv and normal indices become one vertex,
+     * the deduplication runs on all the hardware threads.
+     * @return False if the file cannot be read.
+     */
+    bool load_obj();
 
 
     std::string filename; /**< Filename of the OBJ file. */
-   
+    bool cache; /**< Load and save the parsed mesh in a .ltmesh file next to the OBJ file. */
+
 protected:
     /**
      * @brief Link parameters with the Params struct.
@@ -226,6 +190,7 @@ protected:
     void link_params()
     {
         params.add("filename", &filename);
+        params.add("cache", &cache);
         params.add("brdf", &brdf);
         params.add("local_to_world", &local_to_world);
     }
@@ -368,4 +333,109 @@ protected:
 };
 
 
+/////////////////////
+// Instancing
+///////////////////
+
+/**
+ * @brief Geometry placed several times in the scene by instances.
+ * It is stored and built once, in an Embree scene of its own, that each
+ * Instance places with its transform : the instances are the leaves of the
+ * BVH of the scene and the prototype BVH is shared by all of them.
+ */
+struct Prototype {
+    std::string name; /**< Name the instances refer to. */
+    std::shared_ptr<Geometry> geometry; /**< The geometry, in its local space. */
+    RTCScene rtc_scene = nullptr; /**< Embree scene of the geometry, set by Scene::init_rtc(). */
+};
+
+/**
+ * @brief Class representing a transformed reference to a prototype geometry.
+ */
+class Instance : public Geometry {
+public:
+    /**
+     * @brief Default constructor for Instance.
+     * Initializes the geometry type and links parameters.
+     */
+    Instance()
+        : Geometry("Instance")
+    {
+        link_params();
+
+        this->brdf = std::shared_ptr<Brdf>(nullptr);
+    };
+
+    /**
+     * @brief Initialize the transforms of the instance, its prototype must be set.
+     * Without a BRDF of its own, the instance uses the one of the prototype.
+     */
+    void init()
+    {
+        world_to_local = glm::inverse(local_to_world);
+        normal_to_world = glm::inverse(glm::transpose(glm::mat3(local_to_world)));
+
+        if (!brdf)
+            brdf = prototype->geometry->brdf;
+    }
+
+    Bbox bbox()
+    {
+        Bbox local = prototype->geometry->bbox();
+        Bbox b(vec3(local_to_world * glm::vec4(local.pmin, 1)));
+        for (int i = 1; i < 8; i++) {
+            vec3 corner(i & 1 ? local.pmax.x : local.pmin.x,
+                i & 2 ? local.pmax.y : local.pmin.y,
+                i & 4 ? local.pmax.z : local.pmin.z);
+            b.grow(vec3(local_to_world * glm::vec4(corner, 1)));
+        }
+        return b;
+    }
+
+    /**
+     * @brief Initialize the Embree RTC instance of the prototype scene.
+     * @param device The Embree RTC device.
+     */
+    void init_rtc(RTCDevice device)
+    {
+        rtc_geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_INSTANCE);
+        rtcSetGeometryInstancedScene(rtc_geom, prototype->rtc_scene);
+        rtcSetGeometryTransform(rtc_geom, 0, RTC_FORMAT_FLOAT4X4_COLUMN_MAJOR, glm::value_ptr(local_to_world));
+    }
+
+    /**
+     * @brief Normal of the prototype at the hit position, brought to world space.
+     * The primitive and barycentric coordinates of the hit are those of the prototype.
+     * @param rayhit Information about the ray hit.
+     * @param hit_pos The position of the hit, in world space.
+     * @return The normal vector at the hit position.
+     */
+    vec3 get_normal(RTCRayHit rayhit, const vec3& hit_pos)
+    {
+        vec3 local_pos = vec3(world_to_local * glm::vec4(hit_pos, 1));
+        return glm::normalize(normal_to_world * prototype->geometry->get_normal(rayhit, local_pos));
+    }
+
+    vec2 get_uv(RTCRayHit rayhit, const vec3& hit_pos)
+    {
+        vec3 local_pos = vec3(world_to_local * glm::vec4(hit_pos, 1));
+        return prototype->geometry->get_uv(rayhit, local_pos);
+    }
+
+    std::shared_ptr<Prototype> prototype; /**< The instanced geometry. */
+    glm::mat4 world_to_local; /**< Inverse of local_to_world. */
+    glm::mat3 normal_to_world; /**< Inverse transpose of local_to_world, for the normals. */
+
+protected:
+    /**
+     * @brief Link parameters with the Params struct.
+     */
+    void link_params()
+    {
+        params.add("brdf", &brdf);
+        params.add("local_to_world", &local_to_world);
+    }
+};
+
+
 } // namespace LT_NAMESPACE
@@ -0,0 +1,198 @@
+/**
+ * @file
+ * @brief Definition of the GeometryBuffer class holding the vertex attributes and indices of meshes.
+ */
+
+#pragma once
+#include <lt/lt_common.h>
+
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+namespace LT_NAMESPACE {
+
+/**
+ * @brief Contiguous array of vertex attributes or indices that Embree can read in place.
+ *
+ * Embree reads the buffers given to rtcSetSharedGeometryBuffer() with vector
+ * loads that can go past the last element. The elements are aligned on a
+ * cache line and followed by padding bytes, so the geometry keeps a single
+ * copy of its data instead of a copy of its own and one owned by Embree.
+ *
+ * The elements can also live in memory owned by another object, such as a
+ * mapped file, see set_external().
+ *
+ * A buffer must not grow once shared with Embree, the elements would move.
+ */
+template<typename T>
+class GeometryBuffer {
+    static_assert(std::is_trivially_copyable_v<T>, "GeometryBuffer elements are copied as bytes");
+
+public:
+    static constexpr size_t alignment = 64; /**< Alignment of the first element in bytes. */
+    static constexpr size_t padding = 16; /**< Bytes allocated after the last element, read by Embree. */
+
+    GeometryBuffer()
+        : ptr(nullptr)
+        , n(0)
+        , cap(0)
+    {
+    }
+
+    GeometryBuffer(const GeometryBuffer& other)
+        : GeometryBuffer()
+    {
+        *this = other;
+    }
+
+    GeometryBuffer(GeometryBuffer&& other) noexcept
+        : ptr(other.ptr)
+        , n(other.n)
+        , cap(other.cap)
+        , owner(std::move(other.owner))
+    {
+        other.ptr = nullptr;
+        other.n = other.cap = 0;
+    }
+
+    GeometryBuffer& operator=(const GeometryBuffer& other)
+    {
+        if (this != &other) {
+            // The copy is always allocated, never written to external storage
+            if (owner)
+                release();
+            n = 0;
+            reserve(other.n);
+            if (other.n > 0)
+                std::memcpy(ptr, other.ptr, other.n * sizeof(T));
+            n = other.n;
+        }
+        return *this;
+    }
+
+    GeometryBuffer& operator=(GeometryBuffer&& other) noexcept
+    {
+        if (this != &other) {
+            release();
+            std::swap(ptr, other.ptr);
+            std::swap(n, other.n);
+            std::swap(cap, other.cap);
+            std::swap(owner, other.owner);
+        }
+        return *this;
+    }
+
+    ~GeometryBuffer() { release(); }
+
+    size_t size() const { return n; }
+    bool empty() const { return n == 0; }
+    size_t capacity() const { return cap; }
+
+    T* data() { return ptr; }
+    const T* data() const { return ptr; }
+
+    T& operator[](const size_t& i) { return ptr[i]; }
+    const T& operator[](const size_t& i) const { return ptr[i]; }
+
+    T* begin() { return ptr; }
+    T* end() { return ptr + n; }
+    const T* begin() const { return ptr; }
+    const T* end() const { return ptr + n; }
+
+    /**
+     * @brief Use count elements stored outside of the buffer instead of an allocation.
+     * The storage must be aligned and padded as the allocations of the buffer.
+     * Growing the buffer then copies the elements to an allocation.
+     * @param data The first element.
+     * @param count The number of elements.
+     * @param storage Owner of the storage, kept alive while the buffer uses it.
+     */
+    void set_external(T* data, const size_t& count, std::shared_ptr<void> storage)
+    {
+        release();
+        ptr = data;
+        n = cap = count;
+        owner = std::move(storage);
+    }
+
+    /**
+     * @brief True if the elements are stored outside of the buffer, see set_external().
+     */
+    bool external() const { return owner != nullptr; }
+
+    /**
+     * @brief Allocate room for count elements, the elements are kept.
+     */
+    void reserve(const size_t& count)
+    {
+        if (count > cap)
+            reallocate(count);
+    }
+
+    /**
+     * @brief Change the number of elements, the new ones are zeroed.
+     */
+    void resize(const size_t& count)
+    {
+        reserve(count);
+        if (count > n)
+            std::memset((void*)(ptr + n), 0, (count - n) * sizeof(T));
+        n = count;
+    }
+
+    void push_back(const T& value)
+    {
+        if (n == cap)
+            reallocate(std::max<size_t>(2 * cap, 16));
+        ptr[n++] = value;
+    }
+
+    /**
+     * @brief Remove the elements and keep the storage.
+     */
+    void clear() { n = 0; }
+
+    /**
+     * @brief Release the storage not used by the elements.
+     */
+    void shrink_to_fit()
+    {
+        if (cap > n)
+            reallocate(n);
+    }
+
+private:
+    void reallocate(const size_t& count)
+    {
+        T* p = nullptr;
+        if (count > 0) {
+            p = (T*)::operator new(count * sizeof(T) + padding, std::align_val_t(alignment));
+            std::memset((uint8_t*)p + count * sizeof(T), 0, padding);
+            if (n > 0)
+                std::memcpy(p, ptr, n * sizeof(T));
+        }
+        size_t kept = n;
+        release();
+        ptr = p;
+        n = kept;
+        cap = count;
+    }
+
+    void release()
+    {
+        if (owner)
+            owner.reset();
+        else if (ptr)
+            ::operator delete(ptr, std::align_val_t(alignment));
+        ptr = nullptr;
+        n = cap = 0;
+    }
+
+    T* ptr;
+    size_t n;
+    size_t cap;
+    std::shared_ptr<void> owner; /**< Owner of the external storage, nullptr for an allocation. */
+};
+
+} // namespace LT_NAMESPACE
@@ -1,4 +1,5 @@
 #include <lt/integrator.h>
+#include <lt/wavefront.h>
 
 namespace LT_NAMESPACE {
     
@@ -8,6 +9,7 @@ Factory<Integrator>::CreatorRegistry& Factory<Integrator>::registry()
     static Factory<Integrator>::CreatorRegistry registry {
         { "BrdfIntegrator"  , std::make_shared<BrdfIntegrator>   },
         { "PathIntegrator"  , std::make_shared<PathIntegrator>   },
+        { "WavefrontPathIntegrator", std::make_shared<WavefrontPathIntegrator> },
         { "DirectIntegrator", std::make_shared<DirectIntegrator> },
         { "GonioIntegrator" , std::make_shared<GonioIntegrator>  },
         { "AOIntegrator"    , std::make_shared<AOIntegrator>     }
@@ -8,6 +8,7 @@
 #include <lt/lt_common.h>
 #include <lt/sampler.h>
 #include <lt/scene.h>
+#include <lt/scheduler.h>
 #include <lt/sensor.h>
 #include <lt/serialize.h>
 
@@ -29,8 +30,12 @@ public:
      */
     Integrator(const std::string& type)
         : Serializable(type)
+        , spp_per_pass(1)
+        , packet_size(1)
     {
         n_sample = 1;
+        params.add("spp_per_pass", &spp_per_pass);
+        params.add("packet_size", &packet_size);
     };
 
     /**
@@ -38,75 +43,230 @@ public:
      * @param camera The camera used for rendering.
      * @param sensor The sensor to capture the rendered image.
      * @param scene The scene to render.
-     * @param sampler The sampler used for sampling.
+     * @param sampler The sampler of the integrators that do not render pixel by pixel.
+     * @param scheduler The scheduler dispatching the tiles on the worker threads.
      * @return The time taken in milliseconds.
      */
     virtual float render(std::shared_ptr<Camera> camera, std::shared_ptr<Sensor> sensor,
-        Scene& scene, Sampler& sampler)
+        Scene& scene, Sampler& sampler, Scheduler& scheduler)
     {
         auto t1 = std::chrono::high_resolution_clock::now();
 
-#if 0
-			for (int h = 0; h < sensor->h; h++) {
-				for (int w = 0; w < sensor->w; w++) {
-					float jw = (2. * sampler.next_float()) / (float)sensor->w;
-					float jh = (2. * sampler.next_float()) / (float)sensor->h;
-
-					Ray r = camera->generate_ray(sensor->u[w] + jw, sensor->v[h] + jh);
-					Spectrum s;
-					render_pixel(r, s, scene, sampler);
-						
-					sensor->add(w, h, s);	
-
-				}
-			}
-#endif
-#if 1
-        int block_size = 16;
-        #pragma omp parallel for collapse(2) schedule(dynamic) num_threads(40)
-        for (int h = 0; h < sensor->h / block_size + 1; h++)
-            for (int w = 0; w < sensor->w / block_size + 1; w++) {
-                Sampler s;
-                s.seed((h + w * (block_size + 1) + 1) * n_sample);
-                render_block(h, w, block_size, camera, sensor, scene, sampler);
-            }
+        // One tile buffer per worker, merged into the sensor once per tile
+        film_tiles.resize(scheduler.thread_count());
+        uint32_t guard_band = sensor->filter ? sensor->filter->guard_band() : 0;
+        uint32_t spp = std::max(spp_per_pass, 1u);
 
-#endif
-        n_sample++;
+        scheduler.run(scheduler.active_tiles(sensor->window()),
+            [&](const Tile& tile, const uint32_t& worker_id) {
+                FilmTile& film = film_tiles[worker_id];
+                film.reset(tile, guard_band, *sensor);
+                render_block(tile, film, camera, sensor, scene, spp);
+                sensor->merge(film);
+            });
+
+        n_sample += spp;
         auto t2 = std::chrono::high_resolution_clock::now();
         float delta_time = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
         return delta_time;
     };
 
+    /**
+     * @brief Function called when a tile is done by render_tile_major().
+     * @param tile The tile.
+     * @param film The buffer holding all the samples of the tile.
+     */
+    using TileDone = std::function<void(const Tile& tile, const FilmTile& film)>;
+
+    /**
+     * @brief Renders the scene tile by tile, each tile taking all its samples at once.
+     * The samples are never merged into the sensor : the buffer of a tile is
+     * handed to done and reused for the next tile, so only the settings of the
+     * sensor are used (see Sensor::streamed). With a reconstruction filter the
+     * pixels of the guard band are sampled too, the tile then receives all
+     * the samples splatted by its neighbours.
+     * The pixels take the same samples as with spp / spp_per_pass calls to render().
+     * @param camera The camera used for rendering.
+     * @param sensor The sensor to capture the rendered image.
+     * @param scene The scene to render.
+     * @param scheduler The scheduler dispatching the tiles on the worker threads.
+     * @param spp The number of samples per pixel.
+     * @param done The function receiving the finished tiles, called concurrently by the workers.
+     * @return The time taken in milliseconds.
+     */
+    float render_tile_major(std::shared_ptr<Camera> camera, std::shared_ptr<Sensor> sensor,
+        Scene& scene, Scheduler& scheduler, const uint32_t& spp, const TileDone& done)
+    {
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        film_tiles.resize(scheduler.thread_count());
+        uint32_t guard_band = sensor->filter ? sensor->filter->guard_band() : 0;
+
+        scheduler.run(scheduler.tiles(sensor->window()),
+            [&](const Tile& tile, const uint32_t& worker_id) {
+                FilmTile& film = film_tiles[worker_id];
+                film.reset(tile, guard_band, *sensor);
+                render_block(film.tile, film, camera, sensor, scene, std::max(spp, 1u));
+                done(tile, film);
+            });
+
+        n_sample += std::max(spp, 1u);
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+    }
+
+    /**
+     * @brief Generates the camera ray of a pixel sample.
+     * The ray goes through a uniform position in the pixel, centered on the
+     * pixel center. With a reconstruction filter the position is returned to
+     * splat the sample on the neighbouring pixels.
+     * @param camera The camera used for rendering.
+     * @param sensor The sensor to capture the rendered image.
+     * @param x The x-coordinate of the pixel.
+     * @param y The y-coordinate of the pixel.
+     * @param sampler The random stream of the sample.
+     * @param pos The position of the sample in pixels.
+     * @return The camera ray.
+     */
+    static Ray pixel_ray(Camera& camera, const Sensor& sensor,
+        const uint32_t& x, const uint32_t& y, Sampler& sampler, vec2& pos)
+    {
+        Float dx = sampler.next_float() - 0.5;
+        Float dy = sampler.next_float() - 0.5;
+        pos = sensor.filter ? vec2(x + dx, y + dy) : vec2(x, y);
+        return camera.generate_ray(sensor.u[x] + 2. * dx / (float)sensor.w, sensor.v[y] - 2. * dy / (float)sensor.h);
+    }
+
     /**
      * @brief Renders a block of pixels in the scene.
-     * @param id_h The ID of the block in the vertical direction.
-     * @param id_w The ID of the block in the horizontal direction.
-     * @param block_size The size of the block.
-     * @param camera The camera used for rendering.up
+     * Each pixel takes spp samples, summed locally before a single
+     * write to the tile buffer, or splatted one by one with a reconstruction
+     * filter. When the sensor records AOVs the camera rays are traced here
+     * and shaded with render_hit(). Each pixel sample draws its random numbers from
+     * its own stream, see Sampler::start_pixel_sample().
+     * With a packet_size of 8 or 16 the camera rays are traced in packets,
+     * see render_block_packets().
+     * @param tile The pixels to render.
+     * @param film The buffer receiving the samples of the tile.
+     * @param camera The camera used for rendering.
      * @param sensor The sensor to capture the rendered image.
      * @param scene The scene to render.
-     * @param sampler The sampler used for sampling.
+     * @param spp The number of samples per pixel.
      */
-    void render_block(uint32_t id_h, uint32_t id_w, uint32_t block_size,
+    virtual void render_block(const Tile& tile, FilmTile& film,
         std::shared_ptr<Camera> camera,
-        std::shared_ptr<Sensor> sensor, Scene& scene,
-        Sampler& sampler)
+        std::shared_ptr<Sensor> sensor, Scene& scene, const uint32_t& spp)
     {
-        uint32_t h_min = id_h * block_size;
-        uint32_t w_min = id_w * block_size;
+        if (packet_size == 8)
+            return render_block_packets<8>(tile, film, camera, sensor, scene, spp);
+        if (packet_size == 16)
+            return render_block_packets<16>(tile, film, camera, sensor, scene, spp);
+
+        const Filter* filter = sensor->filter.get();
+
+        for (uint32_t h = tile.y_min; h < tile.y_max; h++) {
+            for (uint32_t w = tile.x_min; w < tile.x_max; w++) {
+                Spectrum sum(0.);
+                Spectrum sum_sqr(0.);
+
+                for (uint32_t i = 0; i < spp; i++) {
+                    Sampler sampler;
+                    sampler.start_pixel_sample(w, h, n_sample + i);
+
+                    vec2 pos;
+                    Ray r = pixel_ray(*camera, *sensor, w, h, sampler, pos);
+
+                    Spectrum s;
+                    if (film.aovs) {
+                        SurfaceInteraction si;
+                        bool hit = scene.intersect(r, si);
+                        film.add_aovs(w, h, hit, si);
+                        s = render_hit(r, hit, si, scene, sampler);
+                    } else {
+                        s = render_pixel(r, scene, sampler);
+                    }
 
-        uint32_t h_max = std::min((id_h + 1) * block_size, sensor->h);
-        uint32_t w_max = std::min((id_w + 1) * block_size, sensor->w);
-        for (int h = h_min; h < h_max; h++) {
-            for (int w = w_min; w < w_max; w++) {
-                float jw = (2. * sampler.next_float()) / (float)sensor->w;
-                float jh = (2. * sampler.next_float()) / (float)sensor->h;
+                    if (filter)
+                        film.splat(w, h, pos, s, *filter);
 
-                Ray r = camera->generate_ray(sensor->u[w] + jw, sensor->v[h] + jh);
-                Spectrum s = render_pixel(r, scene, sampler);
+                    sum += s;
+                    sum_sqr += s * s;
+                }
+
+                if (!filter)
+                    film.add(w, h, sum, sum_sqr, spp);
+            }
+        }
+    }
 
-                sensor->add(w, h, s);
+    /**
+     * @brief Renders a block of pixels, tracing the camera rays in packets.
+     * A packet holds the rays of a 4 x N/4 group of neighbouring pixels, its
+     * lanes are then shaded one by one with render_hit().
+     * @tparam N Width of the packets (8 or 16).
+     */
+    template<int N>
+    void render_block_packets(const Tile& tile, FilmTile& film,
+        std::shared_ptr<Camera> camera,
+        std::shared_ptr<Sensor> sensor, Scene& scene, const uint32_t& spp)
+    {
+        const uint32_t packet_w = 4;
+        const uint32_t packet_h = N / packet_w;
+        const Filter* filter = sensor->filter.get();
+
+        for (uint32_t y0 = tile.y_min; y0 < tile.y_max; y0 += packet_h) {
+            for (uint32_t x0 = tile.x_min; x0 < tile.x_max; x0 += packet_w) {
+                alignas(64) int valid[N];
+                uint32_t x[N];
+                uint32_t y[N];
+                Spectrum sum[N];
+                Spectrum sum_sqr[N];
+
+                for (int l = 0; l < N; l++) {
+                    x[l] = x0 + l % packet_w;
+                    y[l] = y0 + l / packet_w;
+                    valid[l] = x[l] < tile.x_max && y[l] < tile.y_max ? -1 : 0;
+                    sum[l] = Spectrum(0.);
+                    sum_sqr[l] = Spectrum(0.);
+                }
+
+                for (uint32_t i = 0; i < spp; i++) {
+                    Sampler sampler[N];
+                    Ray r[N];
+                    vec2 pos[N];
+                    RTCRayHit rayhit[N];
+
+                    for (int l = 0; l < N; l++) {
+                        if (!valid[l])
+                            continue;
+                        sampler[l].start_pixel_sample(x[l], y[l], n_sample + i);
+                        r[l] = pixel_ray(*camera, *sensor, x[l], y[l], sampler[l], pos[l]);
+                    }
+
+                    scene.intersect_packet<N>(valid, r, rayhit);
+
+                    for (int l = 0; l < N; l++) {
+                        if (!valid[l])
+                            continue;
+                        SurfaceInteraction si;
+                        bool hit = scene.surface_interaction(r[l], rayhit[l], si);
+                        if (film.aovs)
+                            film.add_aovs(x[l], y[l], hit, si);
+                        Spectrum s = render_hit(r[l], hit, si, scene, sampler[l]);
+
+                        if (filter)
+                            film.splat(x[l], y[l], pos[l], s, *filter);
+
+                        sum[l] += s;
+                        sum_sqr[l] += s * s;
+                    }
+                }
+
+                for (int l = 0; l < N; l++) {
+                    if (valid[l] && !filter)
+                        film.add(x[l], y[l], sum[l], sum_sqr[l], spp);
+                }
             }
         }
     }
@@ -120,6 +280,21 @@ public:
      */
     virtual Spectrum render_pixel(Ray& r, Scene& scene, Sampler& sampler) = 0;
 
+    /**
+     * @brief Renders a single pixel from the first intersection of its ray.
+     * Integrators that do not override it trace the ray again with render_pixel().
+     * @param r The ray starting from the pixel.
+     * @param hit True if the ray intersects the scene.
+     * @param si The first intersection of the ray, if any.
+     * @param scene The scene to render.
+     * @param sampler The sampler used for sampling.
+     * @return The resulting contribution.
+     */
+    virtual Spectrum render_hit(Ray& r, const bool& hit, SurfaceInteraction& si, Scene& scene, Sampler& sampler)
+    {
+        return render_pixel(r, scene, sampler);
+    }
+
 
     Spectrum sample_one_light(Ray& r, SurfaceInteraction& si,
         Scene& scene, Sampler& sampler)
@@ -225,10 +400,10 @@ public:
 
         bool vis = false;
         if (light->is_infinite()) {
-            vis = scene.shadow(rs);
+            vis = scene.occluded(rs);
         }
         else {
-            vis = scene.shadow_to(rs, ls.expected_distance_to_intersection);
+            vis = scene.occluded_to(rs, ls.expected_distance_to_intersection);
         }
             
         if (!vis) {
@@ -299,38 +474,69 @@ public:
         return contrib;
     }
 
-    uint32_t n_sample;
+    uint32_t n_sample; /**< Index of the next sample of each pixel. */
+    uint32_t spp_per_pass; /**< Number of samples per pixel rendered by a call to render(). */
+    uint32_t packet_size; /**< Width of the camera ray packets (8 or 16), other values trace rays one by one. */
+
+protected:
+    std::vector<FilmTile> film_tiles; /**< Tile buffer of each worker of the scheduler. */
 };
 
+/**
+ * @brief Path tracing integrator sampling the BRDF only, used as a reference.
+ */
 class BrdfIntegrator : public Integrator {
 public:
     BrdfIntegrator()
         : Integrator("BrdfIntegrator"),
         max_depth(10)
     {
+        packet_size = 8;
         link_params();
     };
 
-    Spectrum render_pixel_rec(Ray& r, Scene& scene, Sampler& sampler,
-        const int& depth)
+    Spectrum render_pixel(Ray& r, Scene& scene, Sampler& sampler)
     {
         SurfaceInteraction si;
+        bool hit = scene.intersect(r, si);
+        return render_hit(r, hit, si, scene, sampler);
+    }
 
+    Spectrum render_hit(Ray& r, const bool& hit, SurfaceInteraction& si, Scene& scene, Sampler& sampler)
+    {
+        Spectrum throughput(1.);
         Spectrum s(0.);
 
-        if (scene.intersect(r, si)) {
+        // The first intersection is given
+        bool traced = true;
+
+        for (int d = 0;; d++) {
+
+            bool intersect = traced ? hit : scene.intersect(r, si);
+            traced = false;
+
+            if (!intersect) {
+                for (const auto& light : scene.infinite_lights) {
+                    s += throughput * light->eval(r.d);
+                }
+                break;
+            }
+
             // Continue if there is no brdf
             if (!si.brdf) {
                 r = Ray(si.pos + r.d * 0.00001f, r.d);
-                return render_pixel_rec(r, scene, sampler, depth);
+                d--;
+                continue;
             }
 
-            if (depth >= max_depth || si.brdf->is_emissive())
-                return si.brdf->emission();
+            if (d >= (int)max_depth || si.brdf->is_emissive()) {
+                s += throughput * si.brdf->emission();
+                break;
+            }
 
             // Compute BRDF contrib
             vec3 wi = si.to_local(-r.d);
-            
+
             bool two_sided = true;
             bool flip = two_sided && wi.z < 0.;
             if (flip) {
@@ -338,51 +544,47 @@ public:
             }
 
             if (wi.z < 0.000001)
-                return s;
-
-            
+                break;
 
             Brdf::Sample bs = si.brdf->sample(wi, si, sampler);
 
             if (bs.wo.z < 0.000001)
-                return s;
+                break;
 
             #if !defined(SAMPLE_OPTIM)
             Float pdf = si.brdf->pdf(wi, bs.wo, si);
             Spectrum brdf_cos_weighted = si.brdf->eval(wi, bs.wo, si, sampler);
             assert(brdf_cos_weighted.x == brdf_cos_weighted.x);
+            throughput *= brdf_cos_weighted / pdf;
+            #else
+            throughput *= bs.value;
             #endif
 
             if (flip) {
                 bs.wo = -bs.wo;
             }
 
-            Ray r_ = Ray(si.pos - r.d * 0.0001f, si.to_world(bs.wo));
-            Spectrum indirect = render_pixel_rec(r_, scene, sampler, depth + 1);
-            
-            #if !defined(SAMPLE_OPTIM)
-            s += brdf_cos_weighted * indirect / pdf;
-            #else
-            s += bs.value * indirect;
-            #endif
+            r = Ray(si.pos - r.d * 0.0001f, si.to_world(bs.wo));
 
-            assert(s.x >= 0);
-            assert(s.x == s.x);
-            
-        } else {
-            for (const auto& light : scene.infinite_lights) {
-                s += light->eval(r.d);
+            Float maxRrBeta = glm::max(throughput.x, throughput.y, throughput.z);
+            const Float rrThreshold = 0.2;
+
+            if (maxRrBeta < 0.000001)
+                break;
+
+            if (maxRrBeta < rrThreshold && d > 2) {
+                Float q = std::max((Float).05, 1 - maxRrBeta);
+                if (sampler.next_float() < q) break;
+                throughput /= 1 - q;
             }
+            assert(throughput == throughput);
         }
 
+        assert(s.x >= 0);
+        assert(s.x == s.x);
         return s;
     }
 
-    Spectrum render_pixel(Ray& r, Scene& scene, Sampler& sampler)
-    {
-        return render_pixel_rec(r, scene, sampler, 0);
-    }
-
     uint32_t max_depth;
 
 protected:
@@ -400,16 +602,22 @@ public:
         : Integrator("DirectIntegrator"),
         sample_all_lights(false)
     {
+        packet_size = 8;
         link_params();
     };
 
     Spectrum render_pixel(Ray& r, Scene& scene, Sampler& sampler)
     {
         SurfaceInteraction si;
+        bool hit = scene.intersect(r, si);
+        return render_hit(r, hit, si, scene, sampler);
+    }
 
+    Spectrum render_hit(Ray& r, const bool& hit, SurfaceInteraction& si, Scene& scene, Sampler& sampler)
+    {
         Spectrum s(0.);
 
-        if (scene.intersect(r, si)) {
+        if (hit) {
 
             if (!si.brdf) {
                 r = Ray(si.pos + r.d * 0.00001f, r.d);
@@ -442,22 +650,35 @@ protected:
  */
 class PathIntegrator : public Integrator {
 public:
-    PathIntegrator()
-        : Integrator("PathIntegrator")
+    PathIntegrator(const std::string& type = "PathIntegrator")
+        : Integrator(type)
         , max_depth(10)
     {
+        packet_size = 8;
         link_params();
     };
 
     Spectrum render_pixel(Ray& r, Scene& scene, Sampler& sampler)
+    {
+        SurfaceInteraction si;
+        bool hit = scene.intersect(r, si);
+        return render_hit(r, hit, si, scene, sampler);
+    }
+
+    Spectrum render_hit(Ray& r, const bool& hit, SurfaceInteraction& si, Scene& scene, Sampler& sampler)
     {
         Spectrum throughput(1.);
         Spectrum s(0.);
 
+        // The first intersection is given
+        bool traced = true;
+
         for (int d = 0; d < max_depth; d++) {
-            
-            SurfaceInteraction si;
-            if (scene.intersect(r, si)) {
+
+            bool intersect = traced ? hit : scene.intersect(r, si);
+            traced = false;
+
+            if (intersect) {
 
 
                 if (!si.brdf) {
@@ -553,16 +774,22 @@ public:
     AOIntegrator()
         : Integrator("AOIntegrator")
     {
+        packet_size = 8;
         link_params();
     };
 
     Spectrum render_pixel(Ray& r, Scene& scene, Sampler& sampler)
     {
         SurfaceInteraction si;
+        bool hit = scene.intersect(r, si);
+        return render_hit(r, hit, si, scene, sampler);
+    }
 
+    Spectrum render_hit(Ray& r, const bool& hit, SurfaceInteraction& si, Scene& scene, Sampler& sampler)
+    {
         Spectrum s(0.);
 
-        if (scene.intersect(r, si)) {
+        if (hit) {
             Ray rs;
             rs.o = si.pos - 0.001f * r.d;
 
@@ -574,7 +801,7 @@ public:
 
                 rs.d = si.to_world(wi);
 
-                if (!scene.shadow(rs))
+                if (!scene.occluded(rs))
                     s += Spectrum(1.) / (float(nSample));
             }
         }
@@ -600,7 +827,7 @@ public:
     };
 
     float render(std::shared_ptr<Camera> camera, std::shared_ptr<Sensor> sensor,
-        Scene& scene, Sampler& sampler)
+        Scene& scene, Sampler& sampler, Scheduler& scheduler)
     {
         auto t1 = std::chrono::high_resolution_clock::now();
 
@@ -233,6 +233,46 @@ static void set_params(const json& j, const Params& params, const std::string& d
     }
 }
 
+/**
+ * @brief Create a geometry from its JSON description.
+ * @param j The JSON object of the geometry.
+ * @param dir Directory of the scene file.
+ * @param brdf_ref Reference to the map of BRDFs.
+ * @param prototype_ref Reference to the map of prototypes, for the instances.
+ * @return The initialized geometry, nullptr on error.
+ */
+static std::shared_ptr<Geometry> generate_geometry(const json& j, const std::string& dir,
+    std::map<std::string, std::shared_ptr<Brdf>>& brdf_ref,
+    std::map<std::string, std::shared_ptr<Prototype>>& prototype_ref)
+{
+    std::shared_ptr<Geometry> geometry = Factory<Geometry>::create(j["type"]);
+    if (!geometry)
+        return nullptr;
+
+    // Set parameters and initialize the geometry
+    set_params(j, geometry->params, dir, brdf_ref);
+
+    // An instance is initialized from its prototype
+    if (std::shared_ptr<Instance> instance = std::dynamic_pointer_cast<Instance>(geometry)) {
+        if (!j.contains("prototype") || prototype_ref.find(j["prototype"]) == prototype_ref.end()) {
+            Log(logError) << "generate_geometry, cause : unknown prototype for the instance " << j;
+            return nullptr;
+        }
+        instance->prototype = prototype_ref[j["prototype"]];
+    }
+
+    geometry->init();
+
+    if (j.contains("build_quality")) {
+        RTCBuildQuality quality;
+        if (!build_quality_from_string(j["build_quality"], quality))
+            return nullptr;
+        geometry->build_quality = quality;
+    }
+
+    return geometry;
+}
+
 /**
  * @brief Generate a scene and renderer from a JSON description.
  *
@@ -271,6 +311,59 @@ static bool generate_from_json(const std::string& path, const std::string& str,
         ren.max_sample = (int)json_scn["max_sample"];
     }
 
+    // Parse Scheduler
+    if (json_scn.contains("scheduler")) {
+        json json_scheduler = json_scn["scheduler"];
+
+        if (json_scheduler.contains("threads"))
+            ren.scheduler->set_threads((uint32_t)json_scheduler["threads"]);
+
+        if (json_scheduler.contains("tile_size"))
+            ren.scheduler->tile_size = (uint32_t)json_scheduler["tile_size"];
+
+        if (json_scheduler.contains("tile_order")
+            && !tile_order_from_string(json_scheduler["tile_order"], ren.scheduler->tile_order))
+            return false;
+    }
+
+    // Parse Embree settings, those already set on the scene (command line) are kept
+    if (json_scn.contains("embree")) {
+        json json_embree = json_scn["embree"];
+        RtcSettings settings;
+        RTCBuildQuality quality;
+        RTCSceneFlags flags;
+
+        if (json_embree.contains("build_quality")) {
+            if (!build_quality_from_string(json_embree["build_quality"], quality))
+                return false;
+            settings.quality = quality;
+        }
+
+        if (json_embree.contains("geometry_build_quality")) {
+            if (!build_quality_from_string(json_embree["geometry_build_quality"], quality))
+                return false;
+            settings.geometry_quality = quality;
+        }
+
+        if (json_embree.contains("flags")) {
+            std::string names;
+            for (const auto& name : json_embree["flags"])
+                names += (names.empty() ? "" : ",") + (std::string)name;
+            if (!scene_flags_from_string(names.empty() ? "none" : names, flags))
+                return false;
+            settings.flags = flags;
+        }
+
+        if (json_embree.contains("device_config"))
+            settings.device_config = (std::string)json_embree["device_config"];
+
+        if (json_embree.contains("benchmark"))
+            settings.benchmark = (bool)json_embree["benchmark"];
+
+        settings.override_with(scn.rtc_settings);
+        scn.rtc_settings = settings;
+    }
+
     // Parse Integrator
     if (json_scn.contains("integrator")) {
         json json_integrator = json_scn["integrator"];
@@ -299,6 +392,21 @@ static bool generate_from_json(const std::string& path, const std::string& str,
 
         // Set parameters and initialize the sensor
         set_params(json_sensor, sensor->params, dir, brdf_ref);
+
+        if (json_sensor.contains("precision")
+            && !film_precision_from_string(json_sensor["precision"], sensor->precision))
+            return false;
+
+        if (json_sensor.contains("crop")) {
+            json json_crop = json_sensor["crop"];
+            if (!json_crop.is_array() || json_crop.size() != 4) {
+                Log(logError) << "generate_from_json, cause : the crop of the sensor is not [x_min, y_min, x_max, y_max] in file " << path;
+                return false;
+            }
+            if (!sensor->set_crop(Window { (uint32_t)json_crop[0], (uint32_t)json_crop[1], (uint32_t)json_crop[2], (uint32_t)json_crop[3] }))
+                return false;
+        }
+
         sensor->init();
 
         ren.sensor = sensor;
@@ -306,6 +414,68 @@ static bool generate_from_json(const std::string& path, const std::string& str,
         Log(logWarning) << "generate_from_json, cause : Missing sensor in file " << path;
     }
 
+    // Parse Filter
+    if (json_scn.contains("filter")) {
+        json json_filter = json_scn["filter"];
+        std::shared_ptr<Filter> filter = Factory<Filter>::create(json_filter["type"]);
+
+        if (!filter)
+            return false;
+
+        if (!ren.sensor) {
+            Log(logError) << "generate_from_json, cause : a filter needs a sensor in file " << path;
+            return false;
+        }
+
+        set_params(json_filter, filter->params, dir, brdf_ref);
+        filter->init();
+
+        ren.sensor->filter = filter;
+    }
+
+    // Parse Adaptive sampling
+    if (json_scn.contains("adaptive")) {
+        json json_adaptive = json_scn["adaptive"];
+
+        if (!std::dynamic_pointer_cast<VarianceSensor>(ren.sensor)) {
+            Log(logError) << "generate_from_json, cause : adaptive sampling needs a VarianceSensor in file " << path;
+            return false;
+        }
+
+        ren.adaptive = std::make_shared<AdaptiveSampling>();
+
+        if (json_adaptive.contains("warmup"))
+            ren.adaptive->warmup = (uint32_t)json_adaptive["warmup"];
+
+        if (json_adaptive.contains("threshold"))
+            ren.adaptive->threshold = (Float)json_adaptive["threshold"];
+    }
+
+    // Parse Denoiser
+    if (json_scn.contains("denoiser")) {
+        json json_denoiser = json_scn["denoiser"];
+
+        ren.denoiser = std::make_shared<Denoiser>();
+
+        if (json_denoiser.contains("radius"))
+            ren.denoiser->radius = (uint32_t)json_denoiser["radius"];
+
+        if (json_denoiser.contains("sigma_spatial"))
+            ren.denoiser->sigma_spatial = (Float)json_denoiser["sigma_spatial"];
+
+        if (json_denoiser.contains("sigma_color"))
+            ren.denoiser->sigma_color = (Float)json_denoiser["sigma_color"];
+
+        if (json_denoiser.contains("sigma_albedo"))
+            ren.denoiser->sigma_albedo = (Float)json_denoiser["sigma_albedo"];
+
+        if (json_denoiser.contains("sigma_normal"))
+            ren.denoiser->sigma_normal = (Float)json_denoiser["sigma_normal"];
+
+        if (json_denoiser.contains("sigma_depth"))
+            ren.denoiser->sigma_depth = (Float)json_denoiser["sigma_depth"];
+    }
+
     // Parse Camera
     if (json_scn.contains("camera")) {
         json json_camera = json_scn["camera"];
@@ -380,20 +550,40 @@ static bool generate_from_json(const std::string& path, const std::string& str,
         Log(logWarning) << "generate_from_json, cause : Missing light in file " << path;
     }
 
+    // Parse Prototypes, the geometries placed by the instances
+    std::map<std::string, std::shared_ptr<Prototype>> prototype_ref;
+    if (json_scn.contains("prototypes")) {
+        for (const auto& json_prototype : json_scn["prototypes"]) {
+            Log(logInfo) << json_prototype;
+
+            if (!json_prototype.contains("name") || json_prototype["type"] == "Instance") {
+                Log(logError) << "generate_from_json, cause : a prototype needs a name and cannot be an instance in file " << path;
+                return false;
+            }
+
+            std::shared_ptr<Prototype> prototype = std::make_shared<Prototype>();
+            prototype->name = json_prototype["name"];
+            prototype->geometry = generate_geometry(json_prototype, dir, brdf_ref, prototype_ref);
+            if (!prototype->geometry)
+                return false;
+
+            prototype_ref[prototype->name] = prototype;
+            scn.prototypes.push_back(prototype);
+        }
+    }
+
     // Parse Geometrys
     if (json_scn.contains("geometries")) {
         for (const auto& json_geometry : json_scn["geometries"]) {
             Log(logInfo) << json_geometry;
 
-            std::shared_ptr<Geometry> geometry = Factory<Geometry>::create(json_geometry["type"]);
+            std::shared_ptr<Geometry> geometry = generate_geometry(json_geometry, dir, brdf_ref, prototype_ref);
             if (!geometry)
                 return false;
 
-            // Set parameters and initialize the geometry
-            set_params(json_geometry, geometry->params, dir, brdf_ref);
-            geometry->init();
-
-            if (geometry->brdf->is_emissive() && geometry->type == "Sphere") {
+            if (geometry->brdf->is_emissive() && geometry->type == "Instance") {
+                Log(logWarning) << "generate_from_json, cause : emissive instances are not sampled as lights in file " << path;
+            } else if (geometry->brdf->is_emissive() && geometry->type == "Sphere") {
                 std::shared_ptr<SphereLight> sphere_light = std::make_shared<SphereLight>();
                 sphere_light->sphere = std::dynamic_pointer_cast<Sphere>(geometry);
                 sphere_light->init();
@@ -1,4 +1,5 @@
 #pragma once
+#include <lt/exr_writer.h>
 #include <lt/lt_common.h>
 #include <lt/sensor.h>
 #include <lt/texture.h>
@@ -6,6 +7,7 @@
 #include <stb_image/stb_image.h>
 
 #include <filesystem>
+#include <map>
 
 
 namespace LT_NAMESPACE {
@@ -141,8 +143,15 @@ static int load_texture(const std::string& path, std::shared_ptr<SpectrumTex>& t
     return -1;
 }
 
-
-static int save_sensor_exr(const Sensor& sen, const std::string& filename)
+/**
+ * @brief Save a RGB image in an EXR, creating its directory if needed.
+ * @param img The pixels of the image, row by row.
+ * @param w Width of the image.
+ * @param h Height of the image.
+ * @param filename Path of the EXR file.
+ * @return 0 on success, the tinyexr error code otherwise.
+ */
+static int save_image_exr(const std::vector<Spectrum>& img, const uint32_t& w, const uint32_t& h, const std::string& filename)
 {
     namespace fs = std::filesystem;
     fs::path p(filename);
@@ -156,7 +165,7 @@ static int save_sensor_exr(const Sensor& sen, const std::string& filename)
     }
 
     const char* err;
-    int ret = SaveEXR((float*)sen.value.data(), sen.w, sen.h, 3, 0,
+    int ret = SaveEXR((const float*)img.data(), w, h, 3, 0,
         filename.c_str(), &err);
     if (ret != TINYEXR_SUCCESS) {
         Log(logError) << "SaveEXR err : " << err;
@@ -168,7 +177,195 @@ static int save_sensor_exr(const Sensor& sen, const std::string& filename)
     return 0;
 };
 
+/**
+ * @brief Save a RGB image stored in planes in an EXR, creating its directory if needed.
+ * Half planes are saved as half channels, float planes as float channels.
+ * @param img The planes of the image, half or float.
+ * @param w Width of the image.
+ * @param h Height of the image.
+ * @param filename Path of the EXR file.
+ * @return 0 on success, the tinyexr error code otherwise.
+ */
+static int save_planes_exr(const FilmPlanes& img, const uint32_t& w, const uint32_t& h, const std::string& filename)
+{
+    if (img.precision == FilmPrecision::Double) {
+        Log(logError) << "save_planes_exr: double planes are not supported";
+        return TINYEXR_ERROR_INVALID_ARGUMENT;
+    }
+
+    namespace fs = std::filesystem;
+    fs::path d = fs::path(filename).parent_path();
+    std::error_code ec;
+    if (!d.empty() && !fs::is_directory(d))
+        fs::create_directories(d, ec);
+
+    // Channels sorted by name, the planes are R, G, B
+    bool half = img.precision == FilmPrecision::Half;
+    std::vector<EXRChannelInfo> channels(3);
+    std::vector<int> pixel_types(3, half ? TINYEXR_PIXELTYPE_HALF : TINYEXR_PIXELTYPE_FLOAT);
+    std::vector<unsigned char*> images(3);
+    const char* names[3] = { "B", "G", "R" };
+    for (int c = 0; c < 3; c++) {
+        memset(&channels[c], 0, sizeof(EXRChannelInfo));
+        strncpy(channels[c].name, names[c], 255);
+        images[c] = half ? (unsigned char*)img.plane<uint16_t>(2 - c) : (unsigned char*)img.plane<float>(2 - c);
+    }
+
+    EXRHeader header;
+    InitEXRHeader(&header);
+    header.num_channels = 3;
+    header.channels = channels.data();
+    header.pixel_types = pixel_types.data();
+    header.requested_pixel_types = pixel_types.data();
+    header.compression_type = TINYEXR_COMPRESSIONTYPE_ZIP;
+
+    EXRImage image;
+    InitEXRImage(&image);
+    image.num_channels = 3;
+    image.images = images.data();
+    image.width = w;
+    image.height = h;
+
+    const char* err = nullptr;
+    int ret = SaveEXRImageToFile(&image, &header, filename.c_str(), &err);
+    if (ret != TINYEXR_SUCCESS) {
+        Log(logError) << "SaveEXRImageToFile err : " << err;
+        FreeEXRErrorMessage(err);
+        return ret;
+    }
+
+    Log(logHighlight) << "Saved exr file. [ " << filename << "]";
+
+    return 0;
+};
+
+/**
+ * @brief Save the value of each pixel of a sensor in a RGB EXR, resolving it first.
+ * With a crop window only its pixels are saved, as the data window of the file.
+ * @param sen The sensor.
+ * @param filename Path of the EXR file.
+ * @return 0 on success, the tinyexr error code otherwise.
+ */
+static int save_sensor_exr(Sensor& sen, const std::string& filename)
+{
+    sen.resolve();
+    Window window = sen.window();
+    if (window != Window { 0, 0, sen.w, sen.h })
+        return save_planes_exr_window(sen.value, sen.w, sen.h, window, filename) ? 0 : TINYEXR_ERROR_CANT_WRITE_FILE;
+    return save_planes_exr(sen.value, sen.w, sen.h, filename);
+};
+
+/**
+ * @brief Save the number of samples of each pixel of a sensor in a single channel EXR.
+ * @param sen The sensor.
+ * @param filename Path of the EXR file.
+ * @return 0 on success, the tinyexr error code otherwise.
+ */
+static int save_sample_count_exr(const Sensor& sen, const std::string& filename)
+{
+    std::vector<float> spp(sen.count.size());
+    for (uint32_t i = 0; i < spp.size(); i++)
+        spp[i] = sen.fresh(i) ? (float)sen.count[i] : 0.f;
+
+    const char* err;
+    int ret = SaveEXR(spp.data(), sen.w, sen.h, 1, 0, filename.c_str(), &err);
+    if (ret != TINYEXR_SUCCESS) {
+        Log(logError) << "SaveEXR err : " << err;
+        return ret;
+    }
+
+    Log(logHighlight) << "Saved exr file. [ " << filename << "]";
+
+    return 0;
+};
+
+/**
+ * @brief Save the value of a sensor and its AOVs in a multi-layer EXR.
+ *
+ * The layers are the radiance (R, G, B), albedo, normal, depth, the geometry
+ * id of the first hit (id, -1 where the camera rays escape) and the number of
+ * samples (spp). The AOVs are averaged over the samples of each pixel.
+ * @param sen The sensor, initialized with aovs set.
+ * @param filename Path of the EXR file.
+ * @return 0 on success, the tinyexr error code otherwise.
+ */
+static int save_aov_exr(Sensor& sen, const std::string& filename)
+{
+    if (sen.aov_albedo.empty()) {
+        Log(logError) << "save_aov_exr: the sensor does not record the AOVs";
+        return TINYEXR_ERROR_INVALID_ARGUMENT;
+    }
 
+    // The AOVs are read directly
+    sen.clear_stale();
+    sen.resolve();
+
+    size_t n = size_t(sen.w) * size_t(sen.h);
+    std::map<std::string, std::vector<float>> layers;
+    auto layer = [&](const std::string& name) -> std::vector<float>& {
+        std::vector<float>& l = layers[name];
+        l.resize(n);
+        return l;
+    };
+
+    std::vector<float>* rgb[3] = { &layer("R"), &layer("G"), &layer("B") };
+    std::vector<float>* albedo[3] = { &layer("albedo.R"), &layer("albedo.G"), &layer("albedo.B") };
+    std::vector<float>* normal[3] = { &layer("normal.X"), &layer("normal.Y"), &layer("normal.Z") };
+    std::vector<float>& depth = layer("depth.Z");
+    std::vector<float>& id = layer("id");
+    std::vector<float>& spp = layer("spp");
+
+    for (size_t i = 0; i < n; i++) {
+        float inv_n = sen.count[i] > 0 ? 1.f / (float)sen.count[i] : 0.f;
+        Spectrum value = sen.value.get(i);
+        for (int c = 0; c < 3; c++) {
+            (*rgb[c])[i] = value[c];
+            (*albedo[c])[i] = sen.aov_albedo[i][c] * inv_n;
+            (*normal[c])[i] = sen.aov_normal[i][c] * inv_n;
+        }
+        depth[i] = sen.aov_depth[i] * inv_n;
+        id[i] = (float)sen.aov_geometry_id[i];
+        spp[i] = (float)sen.count[i];
+    }
+
+    // The channels are sorted by name, as the map is
+    std::vector<EXRChannelInfo> channels(layers.size());
+    std::vector<int> pixel_types(layers.size(), TINYEXR_PIXELTYPE_FLOAT);
+    std::vector<unsigned char*> images;
+    int c = 0;
+    for (auto& [name, data] : layers) {
+        memset(&channels[c], 0, sizeof(EXRChannelInfo));
+        strncpy(channels[c].name, name.c_str(), 255);
+        images.push_back((unsigned char*)data.data());
+        c++;
+    }
 
+    EXRHeader header;
+    InitEXRHeader(&header);
+    header.num_channels = (int)channels.size();
+    header.channels = channels.data();
+    header.pixel_types = pixel_types.data();
+    header.requested_pixel_types = pixel_types.data();
+    header.compression_type = TINYEXR_COMPRESSIONTYPE_ZIP;
+
+    EXRImage image;
+    InitEXRImage(&image);
+    image.num_channels = (int)images.size();
+    image.images = images.data();
+    image.width = sen.w;
+    image.height = sen.h;
+
+    const char* err = nullptr;
+    int ret = SaveEXRImageToFile(&image, &header, filename.c_str(), &err);
+    if (ret != TINYEXR_SUCCESS) {
+        Log(logError) << "SaveEXRImageToFile err : " << err;
+        FreeEXRErrorMessage(err);
+        return ret;
+    }
+
+    Log(logHighlight) << "Saved exr file. [ " << filename << "]";
+
+    return 0;
+};
 
-} // namespace LT_NAMESPACE
\ No newline at end of file
+} // namespace LT_NAMESPACE
@@ -1,16 +1,27 @@
 #pragma once
 
+#include <lt/adaptive.h>
 #include <lt/brdf_common.h>
 #include <lt/camera.h>
+#include <lt/checkpoint.h>
+#include <lt/denoiser.h>
+#include <lt/exr_writer.h>
+#include <lt/film.h>
+#include <lt/filter.h>
 #include <lt/geometry.h>
+#include <lt/geometry_buffer.h>
 #include <lt/integrator.h>
 #include <lt/io.h>
 #include <lt/io_exr.h>
 #include <lt/lt_common.h>
+#include <lt/mapped_file.h>
+#include <lt/mesh_cache.h>
 #include <lt/ray.h>
 #include <lt/sampler.h>
 #include <lt/scene.h>
+#include <lt/scheduler.h>
 #include <lt/sensor.h>
+#include <lt/wavefront.h>
 
 namespace LT_NAMESPACE {
 
@@ -5,6 +5,7 @@
 
 #include <glm/ext.hpp>
 #include <glm/glm.hpp>
+#include <cstring>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -112,6 +113,59 @@ inline std::vector<T> linspace(T start, T end, size_t size, bool centered = true
     return arr;
 }
 
+/**
+ * @brief 64 bit FNV-1a hash of a block of memory.
+ * @param data The bytes to hash.
+ * @param size The number of bytes.
+ * @param seed The hash of the previous blocks, to hash several blocks one after the other.
+ */
+inline uint64_t hash_bytes(const void* data, const size_t& size, uint64_t seed = 14695981039346656037ull)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++) {
+        seed ^= bytes[i];
+        seed *= 1099511628211ull;
+    }
+    return seed;
+}
+
+/**
+ * @brief 64 bit hash of a large block of memory, read 8 bytes at a time on
+ * four independent lanes. Several times faster than hash_bytes(), which it
+ * does not match.
+ * @param data The bytes to hash.
+ * @param size The number of bytes.
+ * @param seed The hash of the previous blocks, to hash several blocks one after the other.
+ */
+inline uint64_t hash_words(const void* data, const size_t& size, uint64_t seed = 14695981039346656037ull)
+{
+    const uint64_t p1 = 0x9E3779B185EBCA87ull;
+    const uint64_t p2 = 0xC2B2AE3D27D4EB4Full;
+    auto rotl = [](const uint64_t& x, const int& r) { return (x << r) | (x >> (64 - r)); };
+
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint64_t lane[4] = { seed + p1 + p2, seed + p2, seed, seed - p1 };
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        for (int l = 0; l < 4; l++) {
+            uint64_t word;
+            std::memcpy(&word, bytes + i + 8 * l, sizeof(word));
+            lane[l] = rotl(lane[l] + word * p2, 31) * p1;
+        }
+    }
+
+    uint64_t h = rotl(lane[0], 1) + rotl(lane[1], 7) + rotl(lane[2], 12) + rotl(lane[3], 18);
+    h = hash_bytes(bytes + i, size - i, h ^ uint64_t(size));
+
+    // Final mix, so that every input bit affects every output bit
+    h ^= h >> 33;
+    h *= p2;
+    h ^= h >> 29;
+    h *= p1;
+    h ^= h >> 32;
+    return h;
+}
+
 inline vec3 polar_to_card(Float theta, Float phi)
 {
     return vec3(sin(theta) * cos(phi), sin(theta) * sin(phi), cos(theta));
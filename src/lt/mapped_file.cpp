@@ -0,0 +1,234 @@
+#include <lt/mapped_file.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <random>
+#include <vector>
+
+namespace LT_NAMESPACE {
+
+MappedFile::MappedFile()
+    : ptr(nullptr)
+    , n(0)
+    , writable(false)
+#ifdef _WIN32
+    , file(INVALID_HANDLE_VALUE)
+    , mapping(nullptr)
+#else
+    , fd(-1)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+std::string temporary_path(const std::string& path)
+{
+    static std::atomic<uint32_t> counter = 0;
+    static const uint32_t seed = std::random_device()();
+
+#ifdef _WIN32
+    uint32_t pid = (uint32_t)GetCurrentProcessId();
+#else
+    uint32_t pid = (uint32_t)getpid();
+#endif
+
+    std::stringstream ss;
+    ss << path << "." << pid << "-" << std::hex << std::setw(8) << std::setfill('0') << (seed ^ counter++) << ".tmp";
+    return ss.str();
+}
+
+bool MappedFile::open(const std::string& path, const bool& copy_on_write)
+{
+    return map(path, 0, copy_on_write ? Mode::CopyOnWrite : Mode::Read);
+}
+
+bool MappedFile::create(const std::string& path, const size_t& size)
+{
+    if (size == 0) {
+        Log(logError) << "MappedFile: cannot map an empty file " << path;
+        return false;
+    }
+    return map(path, size, Mode::Write);
+}
+
+#ifdef _WIN32
+
+bool MappedFile::map(const std::string& path, const size_t& size, const Mode& mode)
+{
+    close();
+
+    bool write = mode == Mode::Write;
+    file = CreateFileA(path.c_str(), write ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+        write ? 0 : FILE_SHARE_READ, nullptr, write ? CREATE_ALWAYS : OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        Log(logError) << "MappedFile: cannot open " << path;
+        return false;
+    }
+
+    LARGE_INTEGER file_size;
+    if (write) {
+        file_size.QuadPart = (LONGLONG)size;
+    } else if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        Log(logError) << "MappedFile: cannot map the empty file " << path;
+        close();
+        return false;
+    }
+
+    DWORD protect = write ? PAGE_READWRITE : mode == Mode::CopyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY;
+    mapping = CreateFileMappingA(file, nullptr, protect,
+        file_size.HighPart, file_size.LowPart, nullptr);
+    if (!mapping) {
+        Log(logError) << "MappedFile: cannot map " << path;
+        close();
+        return false;
+    }
+
+    DWORD access = write ? FILE_MAP_WRITE : mode == Mode::CopyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ;
+    ptr = (uint8_t*)MapViewOfFile(mapping, access, 0, 0, 0);
+    if (!ptr) {
+        Log(logError) << "MappedFile: cannot map " << path;
+        close();
+        return false;
+    }
+
+    n = (size_t)file_size.QuadPart;
+    writable = write;
+    return true;
+}
+
+bool MappedFile::flush()
+{
+    if (!ptr || !writable)
+        return false;
+    return FlushViewOfFile(ptr, 0) && FlushFileBuffers(file);
+}
+
+void MappedFile::close()
+{
+    if (ptr)
+        UnmapViewOfFile(ptr);
+    if (mapping)
+        CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+
+    ptr = nullptr;
+    mapping = nullptr;
+    file = INVALID_HANDLE_VALUE;
+    n = 0;
+    writable = false;
+}
+
+#else
+
+/**
+ * @brief Allocate the blocks of a new file of the given size.
+ * The writes to the mapping of a sparse file raise SIGBUS when the disk is
+ * full, the error is reported here instead.
+ */
+static bool allocate(const int& fd, const size_t& size)
+{
+#ifdef __linux__
+    int err = posix_fallocate(fd, 0, (off_t)size);
+    if (err == 0)
+        return true;
+    if (err != EINVAL && err != EOPNOTSUPP)
+        return false;
+#endif
+    // No fallocate on this system or file system : write the zeros
+    std::vector<uint8_t> zeros(std::min<size_t>(size, 1 << 20), 0);
+    for (size_t offset = 0; offset < size;) {
+        ssize_t written = pwrite(fd, zeros.data(), std::min(zeros.size(), size - offset), (off_t)offset);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        offset += (size_t)written;
+    }
+    return true;
+}
+
+bool MappedFile::map(const std::string& path, const size_t& size, const Mode& mode)
+{
+    close();
+
+    bool write = mode == Mode::Write;
+    fd = ::open(path.c_str(), write ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644);
+    if (fd < 0) {
+        Log(logError) << "MappedFile: cannot open " << path;
+        return false;
+    }
+
+    size_t file_size = size;
+    if (write) {
+        if (!allocate(fd, size)) {
+            Log(logError) << "MappedFile: cannot allocate " << size << " bytes for " << path;
+            close();
+            return false;
+        }
+    } else {
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            Log(logError) << "MappedFile: cannot map the empty file " << path;
+            close();
+            return false;
+        }
+        file_size = (size_t)st.st_size;
+    }
+
+    // Copy on write pages are private, the file is never modified
+    int prot = mode == Mode::Read ? PROT_READ : PROT_READ | PROT_WRITE;
+    void* p = mmap(nullptr, file_size, prot, mode == Mode::CopyOnWrite ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        Log(logError) << "MappedFile: cannot map " << path;
+        close();
+        return false;
+    }
+
+    ptr = (uint8_t*)p;
+    n = file_size;
+    writable = write;
+    return true;
+}
+
+bool MappedFile::flush()
+{
+    if (!ptr || !writable)
+        return false;
+    return msync(ptr, n, MS_SYNC) == 0;
+}
+
+void MappedFile::close()
+{
+    if (ptr)
+        munmap(ptr, n);
+    if (fd >= 0)
+        ::close(fd);
+
+    ptr = nullptr;
+    fd = -1;
+    n = 0;
+    writable = false;
+}
+
+#endif
+
+} // namespace LT_NAMESPACE
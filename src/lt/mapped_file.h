@@ -0,0 +1,91 @@
+/**
+ * @file
+ * @brief Definition of the MappedFile class mapping a file in memory.
+ */
+
+#pragma once
+#include <lt/lt_common.h>
+
+namespace LT_NAMESPACE {
+
+/**
+ * @brief File mapped in the address space of the process.
+ *
+ * Uses mmap on POSIX systems and a file mapping on Windows. The mapping is
+ * released by close() or the destructor.
+ */
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+     * @brief Map an existing file for reading.
+     * @param path Path of the file.
+     * @param copy_on_write If true the pages can also be written, the changes
+     * stay private to the process and never reach the file.
+     * @return True on success.
+     */
+    bool open(const std::string& path, const bool& copy_on_write = false);
+
+    /**
+     * @brief Create or truncate a file of the given size and map it for writing.
+     * The blocks of the file are allocated first, so a full disk fails here
+     * rather than when the mapping is written.
+     * @param path Path of the file.
+     * @param size Size of the file in bytes.
+     * @return True on success.
+     */
+    bool create(const std::string& path, const size_t& size);
+
+    /**
+     * @brief Write the modified pages back to the file and wait for the disk.
+     * @return True on success.
+     */
+    bool flush();
+
+    /**
+     * @brief Unmap and close the file.
+     */
+    void close();
+
+    /**
+     * @brief Start of the mapping, nullptr if no file is mapped.
+     */
+    uint8_t* data() { return ptr; }
+    const uint8_t* data() const { return ptr; }
+
+    /**
+     * @brief Size of the mapping in bytes.
+     */
+    size_t size() const { return n; }
+
+private:
+    enum class Mode { Read, CopyOnWrite, Write };
+
+    bool map(const std::string& path, const size_t& size, const Mode& mode);
+
+    uint8_t* ptr;
+    size_t n;
+    bool writable;
+
+#ifdef _WIN32
+    void* file;
+    void* mapping;
+#else
+    int fd;
+#endif
+};
+
+/**
+ * @brief Path of a temporary file next to a file, unique to the process and the call.
+ * A file written there then renamed to its path is never seen half written,
+ * and concurrent writers of the same file never share the temporary file.
+ * @param path Path of the file.
+ */
+std::string temporary_path(const std::string& path);
+
+} // namespace LT_NAMESPACE
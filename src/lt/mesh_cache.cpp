@@ -0,0 +1,199 @@
+#include <lt/mapped_file.h>
+#include <lt/mesh_cache.h>
+
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+
+namespace LT_NAMESPACE {
+
+static const char mesh_cache_magic[8] = { 'L', 'T', 'M', 'E', 'S', 'H', '\0', '\0' };
+static const uint32_t mesh_cache_version = 2; /**< 2 : the vertices are split on uv seams. */
+
+/**
+ * @brief Start of a mesh cache file, followed by the vertex, normal, uv and
+ * triangle arrays.
+ */
+struct MeshCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t n_vertex;
+    uint32_t n_normal;
+    uint32_t n_uv;
+    uint32_t n_triangle;
+    uint32_t reserved;
+    uint64_t key; /**< Hash of the OBJ file and of the transform. */
+    uint64_t size; /**< Size of the file in bytes. */
+};
+
+/**
+ * @brief Size of an array in the file, arrays start on a cache line and are
+ * followed by the padding of a GeometryBuffer.
+ */
+static size_t padded(const size_t& size)
+{
+    const size_t a = GeometryBuffer<uint8_t>::alignment;
+    return (size + GeometryBuffer<uint8_t>::padding + a - 1) & ~(a - 1);
+}
+
+static uint64_t transform_hash(const glm::mat4& local_to_world)
+{
+    return hash_bytes(glm::value_ptr(local_to_world), 16 * sizeof(float));
+}
+
+std::string mesh_cache_path(const std::string& obj_path, const glm::mat4& local_to_world)
+{
+    std::filesystem::path path(obj_path);
+    path.replace_extension();
+
+    if (local_to_world != glm::mat4(1.)) {
+        std::stringstream ss;
+        ss << "-" << std::hex << std::setw(16) << std::setfill('0') << transform_hash(local_to_world);
+        path += ss.str();
+    }
+    return path.string() + ".ltmesh";
+}
+
+bool mesh_cache_key(const std::string& obj_path, const glm::mat4& local_to_world, uint64_t& key)
+{
+    MappedFile file;
+    if (!file.open(obj_path))
+        return false;
+
+    // The OBJ file is hashed on every load, hash_words() keeps that much
+    // cheaper than the parsing it saves
+    uint64_t transform = transform_hash(local_to_world);
+    key = hash_words(file.data(), file.size(), hash_bytes(&transform, sizeof(transform)));
+    return true;
+}
+
+bool save_mesh_cache(const std::string& path, const uint64_t& key, const TriangleMesh& mesh)
+{
+    MeshCacheHeader header;
+    std::memcpy(header.magic, mesh_cache_magic, sizeof(header.magic));
+    header.version = mesh_cache_version;
+    header.n_vertex = (uint32_t)mesh.vertex.size();
+    header.n_normal = (uint32_t)mesh.normal.size();
+    header.n_uv = (uint32_t)mesh.uv.size();
+    header.n_triangle = (uint32_t)mesh.triangle_indices.size();
+    header.reserved = 0;
+    header.key = key;
+
+    const std::pair<const void*, size_t> sections[] = {
+        { mesh.vertex.data(), mesh.vertex.size() * sizeof(vec3) },
+        { mesh.normal.data(), mesh.normal.size() * sizeof(vec3) },
+        { mesh.uv.data(), mesh.uv.size() * sizeof(vec2) },
+        { mesh.triangle_indices.data(), mesh.triangle_indices.size() * sizeof(glm::uvec3) }
+    };
+
+    header.size = padded(sizeof(MeshCacheHeader));
+    for (const auto& s : sections)
+        header.size += padded(s.second);
+
+    std::string tmp_path = temporary_path(path);
+    bool written = false;
+    {
+        MappedFile file;
+        if (file.create(tmp_path, header.size)) {
+            // The file is created with zeros, the padding is left as is
+            uint8_t* p = file.data();
+            std::memcpy(p, &header, sizeof(MeshCacheHeader));
+            p += padded(sizeof(MeshCacheHeader));
+            for (const auto& s : sections) {
+                if (s.second > 0)
+                    std::memcpy(p, s.first, s.second);
+                p += padded(s.second);
+            }
+
+            written = file.flush();
+            if (!written)
+                Log(logError) << "save_mesh_cache: cannot flush " << tmp_path;
+        }
+    }
+
+    std::error_code ec;
+    if (written) {
+        std::filesystem::rename(tmp_path, path, ec);
+        if (ec)
+            Log(logError) << "save_mesh_cache: cannot rename " << tmp_path << " to " << path << " : " << ec.message();
+    }
+    if (!written || ec) {
+        std::filesystem::remove(tmp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Point a buffer to an array of the mapped file and move to the next array.
+ */
+template<typename T>
+static void map_section(GeometryBuffer<T>& buffer, const uint32_t& count, uint8_t*& p, const std::shared_ptr<MappedFile>& file)
+{
+    if (count > 0)
+        buffer.set_external((T*)p, count, file);
+    else
+        buffer = GeometryBuffer<T>();
+    p += padded(size_t(count) * sizeof(T));
+}
+
+bool load_mesh_cache(const std::string& path, const uint64_t& key, TriangleMesh& mesh)
+{
+    std::error_code ec;
+    if (!std::filesystem::exists(path, ec))
+        return false;
+
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+    if (!file->open(path, true))
+        return false;
+
+    MeshCacheHeader header;
+    if (file->size() < sizeof(MeshCacheHeader)) {
+        Log(logWarning) << "load_mesh_cache: " << path << " is not a mesh cache";
+        return false;
+    }
+    std::memcpy(&header, file->data(), sizeof(MeshCacheHeader));
+
+    if (std::memcmp(header.magic, mesh_cache_magic, sizeof(header.magic)) != 0 || header.version != mesh_cache_version || header.size != file->size()) {
+        Log(logWarning) << "load_mesh_cache: " << path << " is not a valid mesh cache";
+        return false;
+    }
+
+    if (header.key != key) {
+        Log(logInfo) << "load_mesh_cache: " << path << " is out of date";
+        return false;
+    }
+
+    // The normals and uvs are indexed as the vertices, and the arrays fill the file
+    size_t expected_size = padded(sizeof(MeshCacheHeader))
+        + padded(size_t(header.n_vertex) * sizeof(vec3))
+        + padded(size_t(header.n_normal) * sizeof(vec3))
+        + padded(size_t(header.n_uv) * sizeof(vec2))
+        + padded(size_t(header.n_triangle) * sizeof(glm::uvec3));
+    if (header.n_normal != header.n_vertex || header.n_uv != header.n_vertex || expected_size != header.size) {
+        Log(logWarning) << "load_mesh_cache: " << path << " is corrupted, the sizes of its arrays do not match";
+        return false;
+    }
+
+    uint8_t* p = file->data() + padded(sizeof(MeshCacheHeader));
+    map_section(mesh.vertex, header.n_vertex, p, file);
+    map_section(mesh.normal, header.n_normal, p, file);
+    map_section(mesh.uv, header.n_uv, p, file);
+    map_section(mesh.triangle_indices, header.n_triangle, p, file);
+
+    // An index out of range would be read out of bounds by Embree
+    for (size_t i = 0; i < mesh.triangle_indices.size(); i++) {
+        const glm::uvec3& t = mesh.triangle_indices[i];
+        if (t.x >= header.n_vertex || t.y >= header.n_vertex || t.z >= header.n_vertex) {
+            Log(logWarning) << "load_mesh_cache: " << path << " is corrupted, triangle " << i << " has a vertex index out of range";
+            mesh.vertex = GeometryBuffer<vec3>();
+            mesh.normal = GeometryBuffer<vec3>();
+            mesh.uv = GeometryBuffer<vec2>();
+            mesh.triangle_indices = GeometryBuffer<glm::uvec3>();
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace LT_NAMESPACE
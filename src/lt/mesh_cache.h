@@ -0,0 +1,52 @@
+/**
+ * @file
+ * @brief Binary cache of the meshes parsed from OBJ files.
+ */
+
+#pragma once
+#include <lt/geometry.h>
+#include <lt/lt_common.h>
+
+namespace LT_NAMESPACE {
+
+/**
+ * @brief Path of the cache of an OBJ file loaded with a transform.
+ * The cache is next to the OBJ file with the .ltmesh extension, the hash of
+ * the transform is added to the name when it is not the identity.
+ * @param obj_path Path of the OBJ file.
+ * @param local_to_world Transform applied to the vertices.
+ */
+std::string mesh_cache_path(const std::string& obj_path, const glm::mat4& local_to_world);
+
+/**
+ * @brief Key of the cache of an OBJ file : hash of its content and of the transform.
+ * @param obj_path Path of the OBJ file.
+ * @param local_to_world Transform applied to the vertices.
+ * @param key Filled with the key.
+ * @return False if the OBJ file cannot be read.
+ */
+bool mesh_cache_key(const std::string& obj_path, const glm::mat4& local_to_world, uint64_t& key);
+
+/**
+ * @brief Save the vertices, normals, uvs and triangles of a mesh in a cache file.
+ * Each array starts on a cache line and is padded, as a GeometryBuffer.
+ * The file is written next to its destination then renamed.
+ * @param path Path of the cache file.
+ * @param key Key of the cache, see mesh_cache_key().
+ * @param mesh The mesh.
+ * @return True on success.
+ */
+bool save_mesh_cache(const std::string& path, const uint64_t& key, const TriangleMesh& mesh);
+
+/**
+ * @brief Map a cache file into the buffers of a mesh, without copy.
+ * The pages are private copies on write, the file is never modified.
+ * @param path Path of the cache file.
+ * @param key Expected key of the cache, see mesh_cache_key().
+ * @param mesh The mesh, its buffers use the mapped file.
+ * @return False if the file does not exist, is invalid, is corrupted (array
+ * sizes or vertex indices out of range) or has another key.
+ */
+bool load_mesh_cache(const std::string& path, const uint64_t& key, TriangleMesh& mesh);
+
+} // namespace LT_NAMESPACE
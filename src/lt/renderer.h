@@ -4,11 +4,14 @@
  */
 
 #pragma once
+#include <lt/adaptive.h>
 #include <lt/camera.h>
+#include <lt/denoiser.h>
 #include <lt/integrator.h>
 #include <lt/lt_common.h>
 #include <lt/sampler.h>
 #include <lt/scene.h>
+#include <lt/scheduler.h>
 #include <lt/sensor.h>
 
 #include <thread>
@@ -35,16 +38,31 @@ public:
     std::shared_ptr<Sensor> sensor; /**< Pointer to the sensor. */
     std::shared_ptr<Camera> camera; /**< Pointer to the camera. */
     std::shared_ptr<Integrator> integrator; /**< Pointer to the integrator. */
+    std::shared_ptr<Scheduler> scheduler; /**< Pointer to the tile scheduler. */
+    std::shared_ptr<AdaptiveSampling> adaptive; /**< Pointer to the adaptive sampling, nullptr if disabled. */
+    std::shared_ptr<Denoiser> denoiser; /**< Pointer to the denoiser, nullptr if disabled. */
     int max_sample;
 
-    Renderer() : max_sample(1) {}
+    Renderer() : scheduler(std::make_shared<Scheduler>()), max_sample(1) {}
 
     float render(Scene& scene)
     {
-        return integrator->render(camera, sensor, scene, *sampler);
+        float delta_time = integrator->render(camera, sensor, scene, *sampler, *scheduler);
+        if (adaptive)
+            adaptive->update(*sensor, *scheduler);
+        return delta_time;
     }
 
-    void reset() { sensor->reset(); }
+    /**
+     * @brief True if the adaptive sampling stopped the rendering of all the tiles.
+     */
+    bool converged() { return adaptive && scheduler->active_tiles(sensor->window()).empty(); }
+
+    void reset()
+    {
+        sensor->reset();
+        scheduler->activate_all_tiles();
+    }
 };
 
 /**
@@ -54,11 +72,13 @@ class RendererAsync : public Renderer {
 public:
     std::thread thr;
     bool need_reset;
+    bool need_crop;
+    Window pending_crop;
     std::atomic<bool> done;
     bool start;
     float delta_time_ms;
 
-    RendererAsync() { need_reset = false; done = true; start = true; delta_time_ms = 0.; }
+    RendererAsync() { need_reset = false; need_crop = false; pending_crop = Window { 0, 0, 0, 0 }; done = true; start = true; delta_time_ms = 0.; }
 
     ~RendererAsync()
     {
@@ -74,6 +94,28 @@ public:
 
     void reset() { need_reset = true; }
 
+    /**
+     * @brief Change the crop window of the sensor and reset the image.
+     * Applied by the next call to render(), once the running pass is done.
+     * @param window The window, empty for the full frame.
+     */
+    void set_crop(const Window& window)
+    {
+        pending_crop = window;
+        need_crop = true;
+        need_reset = true;
+    }
+
+    /**
+     * @brief Wait for the running pass to finish, the sensor can then be read
+     * safely until the next call to render().
+     */
+    void wait()
+    {
+        if (thr.joinable())
+            thr.join();
+    }
+
     bool render(Scene& scene)
     {
         if (!done) {
@@ -82,9 +124,14 @@ public:
             done = false;
             if (start)
                 start = false;
-            else
+            else if (thr.joinable())
                 thr.join();
 
+            if (need_crop) {
+                sensor->set_crop(pending_crop);
+                need_crop = false;
+            }
+
             if (need_reset) {
                 Renderer::reset();
                 need_reset = false;
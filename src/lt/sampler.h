@@ -30,10 +30,15 @@ public:
         */
     Float next_float() { hash(); return s  * (1.0 / Float(0xffffffffu)); }
 
-    void hash() {
-        uint32_t state = s * 747796405u + 2891336453u;
+    void hash() { s = mix(s); }
+
+    /**
+        * @brief PCG hash of a 32 bits value.
+        */
+    static uint32_t mix(uint32_t v) {
+        uint32_t state = v * 747796405u + 2891336453u;
         uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
-        s = (word >> 22u) ^ word;
+        return (word >> 22u) ^ word;
     }
     /**
         * @brief Change the seed of the random number generator.
@@ -41,6 +46,21 @@ public:
         */
     void seed(uint32_t s_) { s = s_; }
 
+    /**
+        * @brief Start the random stream of a pixel sample.
+        * The stream only depends on the pixel and the sample index, so a
+        * render does not depend on the number of threads nor on the order
+        * in which the pixels are rendered. Successive calls to next_float()
+        * then give the successive dimensions of the sample.
+        * @param x Column of the pixel.
+        * @param y Row of the pixel.
+        * @param sample_index Index of the sample in the pixel.
+        */
+    void start_pixel_sample(uint32_t x, uint32_t y, uint32_t sample_index)
+    {
+        s = mix(x + mix(y + mix(sample_index)));
+    }
+
 private:
     uint32_t s;
 };
@@ -1,4 +1,200 @@
 #include <lt/scene.h>
+#include <lt/sampler.h>
+
+#include <chrono>
+#include <map>
 
 namespace LT_NAMESPACE {
+
+/////////////////////
+// Embree settings
+///////////////////
+
+void RtcSettings::override_with(const RtcSettings& other)
+{
+    if (other.quality)
+        quality = other.quality;
+    if (other.geometry_quality)
+        geometry_quality = other.geometry_quality;
+    if (other.flags)
+        flags = other.flags;
+    if (other.device_config)
+        device_config = other.device_config;
+    if (other.benchmark)
+        benchmark = other.benchmark;
+}
+
+bool build_quality_from_string(const std::string& name, RTCBuildQuality& quality)
+{
+    static const std::map<std::string, RTCBuildQuality> qualities {
+        { "low"   , RTC_BUILD_QUALITY_LOW    },
+        { "medium", RTC_BUILD_QUALITY_MEDIUM },
+        { "high"  , RTC_BUILD_QUALITY_HIGH   }
+    };
+
+    auto it = qualities.find(name);
+    if (it == qualities.end()) {
+        Log(logError) << "build_quality_from_string: unknown build quality \"" << name << "\"";
+        return false;
+    }
+    quality = it->second;
+    return true;
 }
+
+bool scene_flags_from_string(const std::string& names, RTCSceneFlags& flags)
+{
+    static const std::map<std::string, RTCSceneFlags> all_flags {
+        { "none"   , RTC_SCENE_FLAG_NONE    },
+        { "compact", RTC_SCENE_FLAG_COMPACT },
+        { "robust" , RTC_SCENE_FLAG_ROBUST  },
+        { "dynamic", RTC_SCENE_FLAG_DYNAMIC }
+    };
+
+    int f = RTC_SCENE_FLAG_NONE;
+    std::stringstream ss(names);
+    std::string name;
+    while (std::getline(ss, name, ',')) {
+        auto it = all_flags.find(name);
+        if (it == all_flags.end()) {
+            Log(logError) << "scene_flags_from_string: unknown scene flag \"" << name << "\"";
+            return false;
+        }
+        f |= it->second;
+    }
+    flags = (RTCSceneFlags)f;
+    return true;
+}
+
+std::string build_quality_to_string(const RTCBuildQuality& quality)
+{
+    switch (quality) {
+    case RTC_BUILD_QUALITY_LOW:
+        return "low";
+    case RTC_BUILD_QUALITY_HIGH:
+        return "high";
+    case RTC_BUILD_QUALITY_REFIT:
+        return "refit";
+    default:
+        return "medium";
+    }
+}
+
+std::string scene_flags_to_string(const RTCSceneFlags& flags)
+{
+    std::string s;
+    if (flags & RTC_SCENE_FLAG_COMPACT)
+        s += "compact,";
+    if (flags & RTC_SCENE_FLAG_ROBUST)
+        s += "robust,";
+    if (flags & RTC_SCENE_FLAG_DYNAMIC)
+        s += "dynamic,";
+    return s.empty() ? "none" : s.substr(0, s.size() - 1);
+}
+
+
+/////////////////////
+// Scene
+///////////////////
+
+void Scene::init_rtc()
+{
+    if (scene)
+        rtcReleaseScene(scene);
+    if (device)
+        rtcReleaseDevice(device);
+
+    device = rtcNewDevice(rtc_settings.device_config ? rtc_settings.device_config->c_str() : NULL);
+    if (!device) {
+        Log(logError) << "Scene::init_rtc: invalid device config \"" << *rtc_settings.device_config << "\", using the defaults";
+        device = rtcNewDevice(NULL);
+    }
+    scene = rtcNewScene(device);
+
+    RTCBuildQuality quality = rtc_settings.quality.value_or(RTC_BUILD_QUALITY_MEDIUM);
+    RTCSceneFlags flags = rtc_settings.flags.value_or(RTC_SCENE_FLAG_NONE);
+    rtcSetSceneBuildQuality(scene, quality);
+    rtcSetSceneFlags(scene, flags);
+
+    auto start = std::chrono::steady_clock::now();
+
+    // Bottom level : one scene per prototype, kept alive by the instances
+    for (const std::shared_ptr<Prototype>& prototype : prototypes) {
+        std::shared_ptr<Geometry>& geometry = prototype->geometry;
+        prototype->rtc_scene = rtcNewScene(device);
+        rtcSetSceneBuildQuality(prototype->rtc_scene, quality);
+        rtcSetSceneFlags(prototype->rtc_scene, flags);
+
+        geometry->init_rtc(device);
+        rtcSetGeometryBuildQuality(geometry->rtc_geom,
+            rtc_settings.geometry_quality.value_or(geometry->build_quality.value_or(quality)));
+        rtcCommitGeometry(geometry->rtc_geom);
+        geometry->rtc_id = rtcAttachGeometry(prototype->rtc_scene, geometry->rtc_geom);
+        rtcReleaseGeometry(geometry->rtc_geom);
+
+        rtcCommitScene(prototype->rtc_scene);
+    }
+
+    for (size_t i = 0; i < geometries.size(); i++) {
+        geometries[i]->init_rtc(device);
+        rtcSetGeometryBuildQuality(geometries[i]->rtc_geom,
+            rtc_settings.geometry_quality.value_or(geometries[i]->build_quality.value_or(quality)));
+        rtcCommitGeometry(geometries[i]->rtc_geom);
+        //rtcSetGeometryTransform(geometries[i]->rtc_geom, 0, RTC_FORMAT_FLOAT4X4_ROW_MAJOR, (float*)(&geometries[i]->local_to_world[0]) );
+        unsigned int geomID = rtcAttachGeometry(scene, geometries[i]->rtc_geom);
+        geometries[i]->rtc_id = geomID;
+        rtcReleaseGeometry(geometries[i]->rtc_geom);
+    }
+
+    rtcCommitScene(scene);
+
+    for (const std::shared_ptr<Prototype>& prototype : prototypes) {
+        rtcReleaseScene(prototype->rtc_scene);
+        prototype->rtc_scene = nullptr;
+    }
+
+    rtc_build_time = std::chrono::duration<Float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    rtcInitIntersectContext(&context);
+}
+
+void Scene::measure_trace_throughput(const uint32_t& n_rays)
+{
+    rtc_trace_throughput = 0;
+    if (geometries.empty() || n_rays == 0)
+        return;
+
+    // Rays from random points of the bounding box toward random directions
+    Sampler sampler;
+    sampler.seed(0);
+    vec3 extent = bbox.pmax - bbox.pmin;
+
+    std::vector<RTCRayHit> rayhits(n_rays);
+    for (RTCRayHit& rayhit : rayhits) {
+        vec3 o = bbox.pmin + extent * vec3(sampler.next_float(), sampler.next_float(), sampler.next_float());
+        Float z = 1 - 2 * sampler.next_float();
+        Float r = std::sqrt(std::max((Float)0, 1 - z * z));
+        Float phi = 2 * pi * sampler.next_float();
+        init_rayhit(Ray(o, vec3(r * std::cos(phi), r * std::sin(phi), z)), rayhit);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (RTCRayHit& rayhit : rayhits)
+        rtcIntersect1(scene, &context, &rayhit);
+    Float seconds = std::chrono::duration<Float>(std::chrono::steady_clock::now() - start).count();
+
+    rtc_trace_throughput = seconds > 0 ? n_rays / seconds : 0;
+}
+
+std::string Scene::rtc_report() const
+{
+    std::stringstream ss;
+    ss << "BVH " << build_quality_to_string(rtc_settings.quality.value_or(RTC_BUILD_QUALITY_MEDIUM))
+       << " quality, " << scene_flags_to_string(rtc_settings.flags.value_or(RTC_SCENE_FLAG_NONE)) << " flags, "
+       << geometries.size() << " geometries, " << prototypes.size() << " prototypes : built in " << rtc_build_time << " ms";
+    if (rtc_trace_throughput > 0)
+        ss << ", traces " << rtc_trace_throughput * 1e-6 << " Mrays/s per thread, the build costs as much as "
+           << rtc_build_time * 1e-9 * rtc_trace_throughput << " Mrays";
+    return ss.str();
+}
+
+} // namespace LT_NAMESPACE
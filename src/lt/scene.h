@@ -11,6 +11,8 @@
 #include <lt/lt_common.h>
 #include <lt/surface_interaction.h>
 
+#include <optional>
+
 namespace LT_NAMESPACE {
 
 
@@ -163,6 +165,60 @@ public:
 };
 
 
+/////////////////////
+// Embree settings
+///////////////////
+
+/**
+ * @brief Settings of the Embree device and of the BVH built by Scene::init_rtc().
+ * Unset fields keep the Embree defaults.
+ */
+struct RtcSettings {
+    std::optional<RTCBuildQuality> quality; /**< Build quality of the scene BVH. */
+    std::optional<RTCBuildQuality> geometry_quality; /**< Build quality of every geometry, over their own setting. */
+    std::optional<RTCSceneFlags> flags; /**< Compact, robust and dynamic flags of the scene. */
+    std::optional<std::string> device_config; /**< Configuration string given to rtcNewDevice(). */
+    std::optional<bool> benchmark; /**< Measure the trace throughput after the build, off by default, see Scene::measure_trace_throughput(). */
+
+    /**
+     * @brief Replace the settings by those set in other.
+     */
+    void override_with(const RtcSettings& other);
+};
+
+/**
+ * @brief Parse a BVH build quality : low, medium or high.
+ * @return False and log an error if the name is unknown.
+ */
+bool build_quality_from_string(const std::string& name, RTCBuildQuality& quality);
+
+/**
+ * @brief Parse comma separated scene flags : compact, robust, dynamic, or none.
+ * @return False and log an error if a name is unknown.
+ */
+bool scene_flags_from_string(const std::string& names, RTCSceneFlags& flags);
+
+std::string build_quality_to_string(const RTCBuildQuality& quality);
+std::string scene_flags_to_string(const RTCSceneFlags& flags);
+
+/**
+ * @brief Embree ray packet type and intersection function of a packet width.
+ */
+template<int N>
+struct RTCPacket;
+
+template<>
+struct RTCPacket<8> {
+    using RayHit = RTCRayHit8;
+    static void intersect(const int* valid, RTCScene scene, RTCIntersectContext* context, RayHit* rayhit) { rtcIntersect8(valid, scene, context, rayhit); }
+};
+
+template<>
+struct RTCPacket<16> {
+    using RayHit = RTCRayHit16;
+    static void intersect(const int* valid, RTCScene scene, RTCIntersectContext* context, RayHit* rayhit) { rtcIntersect16(valid, scene, context, rayhit); }
+};
+
 /**
  * @brief Class representing a scene for ray tracing.
  */
@@ -178,6 +234,20 @@ public:
     bool intersect(const Ray& r, SurfaceInteraction& si)
     {
         RTCRayHit rayhit;
+        init_rayhit(r, rayhit);
+
+        rtcIntersect1(scene, &context, &rayhit);
+
+        return surface_interaction(r, rayhit, si);
+    }
+
+    /**
+     * @brief Fill an Embree ray hit structure with a ray, ready to be traced.
+     * @param r The ray.
+     * @param rayhit The structure to fill.
+     */
+    static void init_rayhit(const Ray& r, RTCRayHit& rayhit)
+    {
         rayhit.ray.org_x = r.o.x;
         rayhit.ray.org_y = r.o.y;
         rayhit.ray.org_z = r.o.z;
@@ -186,113 +256,123 @@ public:
         rayhit.ray.dir_z = r.d.z;
         rayhit.ray.tnear = 0.f;
         rayhit.ray.tfar = std::numeric_limits<float>::infinity();
+        rayhit.ray.mask = -1;
+        rayhit.ray.flags = 0;
         rayhit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+        rayhit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+    }
 
-        rtcIntersect1(scene, &context, &rayhit);
-
-        if (rayhit.hit.geomID != RTC_INVALID_GEOMETRY_ID) {
-            unsigned int geom_id = rayhit.hit.geomID;
-            std::shared_ptr<Geometry> geom = geometries[geom_id];
-
-            si.t = rayhit.ray.tfar;
-            si.brdf = geom->brdf;
-            si.pos = r.o + r.d * si.t;
-            si.nor = geom->get_normal(rayhit, si.pos);
-            si.uv = geom->get_uv(rayhit, si.pos);
-            si.geom_id = geom_id;
-            
-            si.finalize();
-            return true;
-        }
-
-        return false;
+    /**
+     * @brief Index in geometries of the geometry hit, the instance for a hit
+     * of an instanced prototype.
+     * @param hit The hit of a ray with the scene.
+     */
+    static unsigned int hit_geometry(const RTCHit& hit)
+    {
+        return hit.instID[0] != RTC_INVALID_GEOMETRY_ID ? hit.instID[0] : hit.geomID;
     }
 
     /**
-     * @brief Check if a ray intersects with the scene.
-     * @param r The ray to check for intersection.
+     * @brief Update the surface interaction from a traced ray hit.
+     * @param r The traced ray.
+     * @param rayhit The result of the intersection of r with the scene.
+     * @param si The surface interaction to update if there is an intersection.
      * @return True if the ray intersects with the scene, false otherwise.
      */
-    bool shadow(const Ray &r, const Float& tfar = std::numeric_limits<Float>::infinity()) {
-        /*RTCRay ray;
-        ray.org_x = r.o.x;
-        ray.org_y = r.o.y;
-        ray.org_z = r.o.z;
-        ray.dir_x = r.d.x;
-        ray.dir_y = r.d.y;
-        ray.dir_z = r.d.z;
-        ray.tnear = 0.f;
-        ray.tfar = tfar;
-        ray.flags = 0;
-
-        rtcOccluded1(scene, &context, &ray);
-
-        if (ray.tfar < 0.) {
-        return true;
-        }
-
-        return false;*/
-
-        //RTCRayHit rayhit;
-        //rayhit.ray.org_x = r.o.x;
-        //rayhit.ray.org_y = r.o.y;
-        //rayhit.ray.org_z = r.o.z;
-        //rayhit.ray.dir_x = r.d.x;
-        //rayhit.ray.dir_y = r.d.y;
-        //rayhit.ray.dir_z = r.d.z;
-        //rayhit.ray.tnear = 0.f;
-        //rayhit.ray.tfar = std::numeric_limits<float>::infinity();
-        //rayhit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
-
-        //rtcIntersect1(scene, &context, &rayhit);
-
-        //if (rayhit.hit.geomID != RTC_INVALID_GEOMETRY_ID && rayhit.ray.tfar < tfar) {
-        //    return true;
-        //}
+    bool surface_interaction(const Ray& r, const RTCRayHit& rayhit, SurfaceInteraction& si)
+    {
+        if (rayhit.hit.geomID == RTC_INVALID_GEOMETRY_ID)
+            return false;
 
-        //return false;
+        unsigned int geom_id = hit_geometry(rayhit.hit);
+        const std::shared_ptr<Geometry>& geom = geometries[geom_id];
 
-        RTCRayHit rayhit;
-        rayhit.ray.org_x = r.o.x;
-        rayhit.ray.org_y = r.o.y;
-        rayhit.ray.org_z = r.o.z;
-        rayhit.ray.dir_x = r.d.x;
-        rayhit.ray.dir_y = r.d.y;
-        rayhit.ray.dir_z = r.d.z;
-        rayhit.ray.tnear = 0.f;
-        rayhit.ray.tfar = std::numeric_limits<float>::infinity();
-        rayhit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+        si.t = rayhit.ray.tfar;
+        si.brdf = geom->brdf;
+        si.pos = r.o + r.d * si.t;
+        si.nor = geom->get_normal(rayhit, si.pos);
+        si.uv = geom->get_uv(rayhit, si.pos);
+        si.geom_id = geom_id;
 
-        rtcIntersect1(scene, &context, &rayhit);
+        si.finalize();
+        return true;
+    }
 
-        if (rayhit.ray.tfar < tfar) {
-            return true;
+    /**
+     * @brief Intersect a packet of N coherent rays with the scene (rtcIntersect8/16).
+     * @param valid Mask of the active lanes, -1 for active and 0 for inactive.
+     * @param rays The N rays.
+     * @param rayhits Filled with the result of each active lane, to be used with surface_interaction().
+     */
+    template<int N>
+    void intersect_packet(const int* valid, const Ray* rays, RTCRayHit* rayhits)
+    {
+        typename RTCPacket<N>::RayHit packet;
+        for (int i = 0; i < N; i++) {
+            packet.ray.org_x[i] = rays[i].o.x;
+            packet.ray.org_y[i] = rays[i].o.y;
+            packet.ray.org_z[i] = rays[i].o.z;
+            packet.ray.dir_x[i] = rays[i].d.x;
+            packet.ray.dir_y[i] = rays[i].d.y;
+            packet.ray.dir_z[i] = rays[i].d.z;
+            packet.ray.tnear[i] = 0.f;
+            packet.ray.tfar[i] = std::numeric_limits<float>::infinity();
+            packet.ray.time[i] = 0.f;
+            packet.ray.mask[i] = -1;
+            packet.ray.flags[i] = 0;
+            packet.hit.geomID[i] = RTC_INVALID_GEOMETRY_ID;
+            packet.hit.instID[0][i] = RTC_INVALID_GEOMETRY_ID;
         }
 
-        return false;
+        RTCIntersectContext ctx;
+        rtcInitIntersectContext(&ctx);
+        ctx.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
+
+        RTCPacket<N>::intersect(valid, scene, &ctx, &packet);
+
+        for (int i = 0; i < N; i++) {
+            if (!valid[i])
+                continue;
+            init_rayhit(rays[i], rayhits[i]);
+            rayhits[i].ray.tfar = packet.ray.tfar[i];
+            rayhits[i].hit.Ng_x = packet.hit.Ng_x[i];
+            rayhits[i].hit.Ng_y = packet.hit.Ng_y[i];
+            rayhits[i].hit.Ng_z = packet.hit.Ng_z[i];
+            rayhits[i].hit.u = packet.hit.u[i];
+            rayhits[i].hit.v = packet.hit.v[i];
+            rayhits[i].hit.primID = packet.hit.primID[i];
+            rayhits[i].hit.geomID = packet.hit.geomID[i];
+            rayhits[i].hit.instID[0] = packet.hit.instID[0][i];
+        }
     }
 
-    bool shadow_to(const Ray& r, const Float& tfar) {
+    /**
+     * @brief Intersect a stream of rays with the scene (rtcIntersect1M).
+     * The rays must have been set with init_rayhit().
+     * @param rayhits The rays, updated with their closest hit.
+     * @param count The number of rays.
+     * @param coherent True if the rays are coherent (ex: camera rays).
+     */
+    void intersect_stream(RTCRayHit* rayhits, const uint32_t& count, const bool& coherent = false)
+    {
+        if (count == 0)
+            return;
 
-        RTCRayHit rayhit;
-        rayhit.ray.org_x = r.o.x;
-        rayhit.ray.org_y = r.o.y;
-        rayhit.ray.org_z = r.o.z;
-        rayhit.ray.dir_x = r.d.x;
-        rayhit.ray.dir_y = r.d.y;
-        rayhit.ray.dir_z = r.d.z;
-        rayhit.ray.tnear = 0.f;
-        rayhit.ray.tfar = std::numeric_limits<float>::infinity();
-        rayhit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+        RTCIntersectContext ctx;
+        rtcInitIntersectContext(&ctx);
+        ctx.flags = coherent ? RTC_INTERSECT_CONTEXT_FLAG_COHERENT : RTC_INTERSECT_CONTEXT_FLAG_INCOHERENT;
 
-        rtcIntersect1(scene, &context, &rayhit);
-        float epsilon = 0.0001;
-        if (rayhit.ray.tfar < tfar + epsilon && rayhit.ray.tfar > tfar - epsilon) {
-            return false;
-        }
-        return true;
+        rtcIntersect1M(scene, &ctx, rayhits, count, sizeof(RTCRayHit));
+    }
 
-        /*RTCRay ray;
+    /**
+     * @brief Fill an Embree ray structure with a ray segment, ready for an occlusion query.
+     * @param r The ray.
+     * @param ray The structure to fill.
+     * @param tfar The end of the segment, infinity for the whole ray.
+     */
+    static void init_ray(const Ray& r, RTCRay& ray, const Float& tfar = std::numeric_limits<Float>::infinity())
+    {
         ray.org_x = r.o.x;
         ray.org_y = r.o.y;
         ray.org_z = r.o.z;
@@ -300,62 +380,118 @@ public:
         ray.dir_y = r.d.y;
         ray.dir_z = r.d.z;
         ray.tnear = 0.f;
-        ray.tfar = std::numeric_limits<float>::infinity();
-        
-        rtcOccluded1(scene, &context, &ray);
-        const float epsilon = 0.0001;
-        if (ray.tfar < tfar + epsilon && ray.tfar > tfar - epsilon) {
-            return false;
-        }
-        return true;*/
+        ray.tfar = tfar;
+        ray.time = 0.f;
+        ray.mask = -1;
+        ray.flags = 0;
+    }
 
+    /**
+     * @brief Check if a ray segment is occluded by the scene.
+     * The traversal stops at the first hit found (rtcOccluded1).
+     * @param r The ray to check for intersection.
+     * @param tfar The end of the segment, infinity for the whole ray.
+     * @return True if the ray intersects the scene before tfar, false otherwise.
+     */
+    bool occluded(const Ray& r, const Float& tfar = std::numeric_limits<Float>::infinity())
+    {
+        RTCRay ray;
+        init_ray(r, ray, tfar);
 
+        rtcOccluded1(scene, &context, &ray);
+
+        return ray.tfar < 0.;
     }
 
+    /**
+     * @brief Check if the segment between the ray origin and a point at the
+     * given distance along the ray is occluded, ignoring a hit on the point itself.
+     * @param r The ray to check for intersection.
+     * @param distance Distance to the end point (ex: a light sample).
+     * @return True if the segment intersects the scene, false otherwise.
+     */
+    bool occluded_to(const Ray& r, const Float& distance)
+    {
+        return occluded(r, distance - occlusion_epsilon);
+    }
 
     /**
-     * @brief Initialize Embree RTC device and scene.
+     * @brief Occlusion queries of a stream of ray segments (rtcOccluded1M).
+     * @param rays The segments, set with init_ray().
+     * @param occluded Filled with 1 when a segment is occluded, 0 otherwise.
+     * @param count The number of segments.
      */
-    void init_rtc()
+    void occluded_stream(RTCRay* rays, uint8_t* occluded, const uint32_t& count)
     {
-        device = rtcNewDevice(NULL);
-        scene = rtcNewScene(device);
-
-        for (int i = 0; i < geometries.size(); i++) {
-            geometries[i]->init_rtc(device);
-            rtcCommitGeometry(geometries[i]->rtc_geom);
-            //rtcSetGeometryTransform(geometries[i]->rtc_geom, 0, RTC_FORMAT_FLOAT4X4_ROW_MAJOR, (float*)(&geometries[i]->local_to_world[0]) );
-            unsigned int geomID = rtcAttachGeometry(scene, geometries[i]->rtc_geom);
-            geometries[i]->rtc_id = geomID;
-            rtcReleaseGeometry(geometries[i]->rtc_geom);
-        }
+        if (count == 0)
+            return;
 
-        rtcCommitScene(scene);
+        RTCIntersectContext ctx;
+        rtcInitIntersectContext(&ctx);
 
-        rtcInitIntersectContext(&context);
+        rtcOccluded1M(scene, &ctx, rays, count, sizeof(RTCRay));
+
+        for (uint32_t i = 0; i < count; i++)
+            occluded[i] = rays[i].tfar < 0.;
     }
 
+    static constexpr Float occlusion_epsilon = 0.0001; /**< Length removed at the end of the segments of occluded_to(). */
+
+    /**
+     * @brief Initialize Embree RTC device and scene.
+     * The device, the scene flags and the build qualities are those of
+     * rtc_settings, the geometries use their own build quality when set.
+     * The prototypes are built first, in their own scenes, for the instances.
+     * The time spent building the BVH is kept in rtc_build_time.
+     */
+    void init_rtc();
+
     void init()
     {
-        
+
         if (geometries.size() > 0) {
             bbox = geometries[0]->bbox();
             for (auto geometry : geometries) {
                 bbox.grow(geometry->bbox());
             }
         }
-        
+
         ps = std::make_shared<PowerStrategie>(lights, infinite_lights);
         sps = std::make_shared<SpatialPowerStrategie>(lights, infinite_lights, bbox, 50);
 
+        // Tracing the benchmark rays costs as much as a small render, only on request
+        if (rtc_settings.benchmark.value_or(false))
+            measure_trace_throughput();
+        else
+            rtc_trace_throughput = 0;
+        Log(logInfo) << rtc_report();
     }
 
-    RTCDevice device; /**< Embree RTC device. */
-    RTCScene scene; /**< Embree RTC scene. */
+    /**
+     * @brief Trace random rays through the bounding box of the scene and keep
+     * the rays per second of a single thread in rtc_trace_throughput.
+     * @param n_rays The number of rays traced.
+     */
+    void measure_trace_throughput(const uint32_t& n_rays = 1 << 16);
+
+    /**
+     * @brief One line summary of the BVH : its settings, build time and trace
+     * throughput when it was measured.
+     */
+    std::string rtc_report() const;
+
+    RTCDevice device = nullptr; /**< Embree RTC device. */
+    RTCScene scene = nullptr; /**< Embree RTC scene. */
     RTCIntersectContext context; /**< Embree RTC intersect context. */
 
+    RtcSettings rtc_settings; /**< Settings of the device and of the BVH. */
+    Float rtc_build_time = 0; /**< Time spent building the BVH by init_rtc() in ms. */
+    Float rtc_trace_throughput = 0; /**< Rays per second of one thread, see measure_trace_throughput(), 0 if not measured. */
+
     std::vector<std::shared_ptr<Geometry>>
         geometries; /**< Vector of geometry in the scene. */
+    std::vector<std::shared_ptr<Prototype>>
+        prototypes; /**< Geometries placed in the scene by the instances. */
     std::vector<std::shared_ptr<Light>>
         lights; /**< Vector of light in the scene. */
     std::vector<std::shared_ptr<Brdf>> brdfs; /**< Vector of BRDF in the scene. */
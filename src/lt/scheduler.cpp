@@ -0,0 +1,322 @@
+#include <lt/scheduler.h>
+
+#include <algorithm>
+#include <map>
+
+namespace LT_NAMESPACE {
+
+/////////////////////
+// Tile orders
+///////////////////
+
+bool tile_order_from_string(const std::string& name, TileOrder& order)
+{
+    static const std::map<std::string, TileOrder> orders {
+        { "scanline", TileOrder::Scanline },
+        { "spiral"  , TileOrder::Spiral   },
+        { "hilbert" , TileOrder::Hilbert  }
+    };
+
+    auto it = orders.find(name);
+    if (it == orders.end()) {
+        Log(logError) << "tile_order_from_string: unknown tile order \"" << name << "\"";
+        return false;
+    }
+    order = it->second;
+    return true;
+}
+
+/**
+ * @brief Distance along the Hilbert curve of the cell (x, y) of a n x n grid.
+ * @param n Size of the grid, a power of two.
+ */
+static uint64_t hilbert_index(const uint32_t& n, uint32_t x, uint32_t y)
+{
+    uint64_t d = 0;
+    for (uint32_t s = n / 2; s > 0; s /= 2) {
+        uint32_t rx = (x & s) > 0;
+        uint32_t ry = (y & s) > 0;
+        d += uint64_t(s) * uint64_t(s) * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+std::vector<Tile> generate_tiles(const uint32_t& w, const uint32_t& h, const uint32_t& tile_size, const TileOrder& order)
+{
+    return generate_tiles(Window { 0, 0, w, h }, tile_size, order);
+}
+
+std::vector<Tile> generate_tiles(const Window& window, const uint32_t& tile_size, const TileOrder& order)
+{
+    uint32_t size = std::max(tile_size, 1u);
+    uint32_t nx = (window.width() + size - 1) / size;
+    uint32_t ny = (window.height() + size - 1) / size;
+
+    std::vector<Tile> grid;
+    grid.reserve(nx * ny);
+    for (uint32_t ty = 0; ty < ny; ty++) {
+        for (uint32_t tx = 0; tx < nx; tx++) {
+            Tile t;
+            t.x_min = window.x_min + tx * size;
+            t.y_min = window.y_min + ty * size;
+            t.x_max = std::min(t.x_min + size, window.x_max);
+            t.y_max = std::min(t.y_min + size, window.y_max);
+            t.id = ty * nx + tx;
+            grid.push_back(t);
+        }
+    }
+
+    switch (order) {
+    case TileOrder::Spiral: {
+        std::vector<Tile> tiles;
+        tiles.reserve(grid.size());
+
+        int x = int(nx / 2);
+        int y = int(ny / 2);
+        int dx = 1;
+        int dy = 0;
+        auto visit = [&]() {
+            if (x >= 0 && y >= 0 && x < int(nx) && y < int(ny))
+                tiles.push_back(grid[y * nx + x]);
+        };
+
+        visit();
+        for (int len = 1; tiles.size() < grid.size(); len++) {
+            for (int k = 0; k < 2; k++) {
+                for (int i = 0; i < len; i++) {
+                    x += dx;
+                    y += dy;
+                    visit();
+                }
+                int tmp = dx;
+                dx = -dy;
+                dy = tmp;
+            }
+        }
+        return tiles;
+    }
+    case TileOrder::Hilbert: {
+        uint32_t n = 1;
+        while (n < std::max(nx, ny))
+            n *= 2;
+
+        std::vector<uint64_t> keys(grid.size());
+        for (uint32_t i = 0; i < grid.size(); i++)
+            keys[i] = hilbert_index(n, i % nx, i / nx);
+
+        std::stable_sort(grid.begin(), grid.end(), [&](const Tile& a, const Tile& b) {
+            return keys[a.id] < keys[b.id];
+        });
+        return grid;
+    }
+    case TileOrder::Scanline:
+    default:
+        return grid;
+    }
+}
+
+
+/////////////////////
+// Scheduler
+///////////////////
+
+Scheduler::Scheduler(const uint32_t& n_threads)
+    : tile_size(16)
+    , tile_order(TileOrder::Hilbert)
+    , generation(0)
+    , running(0)
+    , quit(false)
+    , job_tiles(nullptr)
+    , job(nullptr)
+    , active_dirty(true)
+    , cached_window { 0, 0, 0, 0 }
+    , cached_tile_size(0)
+    , cached_tile_order(TileOrder::Hilbert)
+{
+    start(n_threads);
+}
+
+Scheduler::~Scheduler()
+{
+    stop();
+}
+
+void Scheduler::set_threads(const uint32_t& n_threads)
+{
+    stop();
+    start(n_threads);
+}
+
+void Scheduler::start(const uint32_t& n_threads)
+{
+    uint32_t n = n_threads > 0 ? n_threads : std::max(std::thread::hardware_concurrency(), 1u);
+
+    quit = false;
+    workers.clear();
+    for (uint32_t i = 0; i < n; i++)
+        workers.push_back(std::make_unique<Worker>());
+
+    // Worker 0 is the thread calling run()
+    for (uint32_t i = 1; i < n; i++)
+        threads.emplace_back(&Scheduler::worker_loop, this, i, generation);
+}
+
+void Scheduler::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_all();
+
+    for (std::thread& t : threads)
+        t.join();
+    threads.clear();
+}
+
+const std::vector<Tile>& Scheduler::tiles(const uint32_t& w, const uint32_t& h)
+{
+    return tiles(Window { 0, 0, w, h });
+}
+
+const std::vector<Tile>& Scheduler::tiles(const Window& window)
+{
+    if (window != cached_window || tile_size != cached_tile_size || tile_order != cached_tile_order) {
+        cached_tiles = generate_tiles(window, tile_size, tile_order);
+        cached_window = window;
+        cached_tile_size = tile_size;
+        cached_tile_order = tile_order;
+
+        tile_active.assign(cached_tiles.size(), 1);
+        active_dirty = true;
+    }
+    return cached_tiles;
+}
+
+const std::vector<Tile>& Scheduler::active_tiles(const uint32_t& w, const uint32_t& h)
+{
+    return active_tiles(Window { 0, 0, w, h });
+}
+
+const std::vector<Tile>& Scheduler::active_tiles(const Window& window)
+{
+    tiles(window);
+
+    if (active_dirty) {
+        cached_active_tiles.clear();
+        for (const Tile& t : cached_tiles) {
+            if (tile_active[t.id])
+                cached_active_tiles.push_back(t);
+        }
+        active_dirty = false;
+    }
+    return cached_active_tiles;
+}
+
+void Scheduler::set_tile_active(const uint32_t& id, const bool& active)
+{
+    if (id < tile_active.size() && tile_active[id] != active) {
+        tile_active[id] = active;
+        active_dirty = true;
+    }
+}
+
+void Scheduler::activate_all_tiles()
+{
+    std::fill(tile_active.begin(), tile_active.end(), 1);
+    active_dirty = true;
+}
+
+void Scheduler::run(const std::vector<Tile>& tiles, const TileFunction& f)
+{
+    if (tiles.empty())
+        return;
+
+    // Deal the tiles round robin so every worker walks the tile order from its start
+    for (uint32_t i = 0; i < tiles.size(); i++)
+        workers[i % workers.size()]->queue.push_back(i);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job_tiles = &tiles;
+        job = &f;
+        running = (uint32_t)workers.size();
+        generation++;
+    }
+    wake.notify_all();
+
+    execute(0);
+
+    // Wait until every worker left the pass so none of them can touch the
+    // queues of the next one with this pass function.
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return running == 0; });
+    job_tiles = nullptr;
+    job = nullptr;
+}
+
+void Scheduler::worker_loop(const uint32_t& worker_id, uint64_t seen)
+{
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return quit || generation != seen; });
+            if (quit)
+                return;
+            seen = generation;
+        }
+        execute(worker_id);
+    }
+}
+
+void Scheduler::execute(const uint32_t& worker_id)
+{
+    uint32_t tile_idx;
+    while (next_tile(worker_id, tile_idx))
+        (*job)((*job_tiles)[tile_idx], worker_id);
+
+    bool last = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running--;
+        last = running == 0;
+    }
+    if (last)
+        done.notify_all();
+}
+
+bool Scheduler::next_tile(const uint32_t& worker_id, uint32_t& tile_idx)
+{
+    // Own tiles first, in dispatch order
+    {
+        Worker& w = *workers[worker_id];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (!w.queue.empty()) {
+            tile_idx = w.queue.front();
+            w.queue.pop_front();
+            return true;
+        }
+    }
+
+    // Then steal the last tiles of the other workers
+    for (uint32_t i = 1; i < workers.size(); i++) {
+        Worker& w = *workers[(worker_id + i) % workers.size()];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (!w.queue.empty()) {
+            tile_idx = w.queue.back();
+            w.queue.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+} // namespace LT_NAMESPACE
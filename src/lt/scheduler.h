@@ -0,0 +1,203 @@
+/**
+ * @file
+ * @brief Definition of the Scheduler class used to dispatch tiles of pixels
+ * on a persistent pool of worker threads.
+ */
+
+#pragma once
+#include <lt/lt_common.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace LT_NAMESPACE {
+
+/**
+ * @brief Rectangle of pixels rendered as a single unit of work.
+ */
+struct Tile {
+    uint32_t x_min; /**< First column of the tile. */
+    uint32_t y_min; /**< First row of the tile. */
+    uint32_t x_max; /**< Last column of the tile (excluded). */
+    uint32_t y_max; /**< Last row of the tile (excluded). */
+    uint32_t id; /**< Index of the tile in the row major tile grid. */
+};
+
+/**
+ * @brief Rectangle of pixels of an image, such as a crop window.
+ */
+struct Window {
+    uint32_t x_min; /**< First column of the window. */
+    uint32_t y_min; /**< First row of the window. */
+    uint32_t x_max; /**< Last column of the window (excluded). */
+    uint32_t y_max; /**< Last row of the window (excluded). */
+
+    uint32_t width() const { return x_max > x_min ? x_max - x_min : 0; }
+    uint32_t height() const { return y_max > y_min ? y_max - y_min : 0; }
+
+    bool operator==(const Window& o) const
+    {
+        return x_min == o.x_min && y_min == o.y_min && x_max == o.x_max && y_max == o.y_max;
+    }
+    bool operator!=(const Window& o) const { return !(*this == o); }
+};
+
+/**
+ * @brief Order in which the tiles of a frame are dispatched.
+ */
+enum class TileOrder {
+    Scanline, /**< Row by row, from the top left tile. */
+    Spiral, /**< Outward square spiral, from the center tile. */
+    Hilbert /**< Along a Hilbert curve, keeps consecutive tiles close in image space. */
+};
+
+/**
+ * @brief Convert a tile order name ("scanline", "spiral" or "hilbert") to a TileOrder.
+ * @param name The name of the order.
+ * @param order The order to fill, unchanged if the name is unknown.
+ * @return True if the name is a valid tile order.
+ */
+bool tile_order_from_string(const std::string& name, TileOrder& order);
+
+/**
+ * @brief Split a w x h image in tiles, sorted in the given order.
+ * @param w Width of the image.
+ * @param h Height of the image.
+ * @param tile_size Size of the side of a tile in pixels.
+ * @param order Dispatch order of the tiles.
+ * @return The list of tiles covering the image.
+ */
+std::vector<Tile> generate_tiles(const uint32_t& w, const uint32_t& h, const uint32_t& tile_size, const TileOrder& order);
+
+/**
+ * @brief Split a window of an image in tiles, sorted in the given order.
+ * The tile grid starts at the corner of the window, Tile::id is the index
+ * of a tile in the row major grid of the window.
+ * @param window The pixels to cover.
+ * @param tile_size Size of the side of a tile in pixels.
+ * @param order Dispatch order of the tiles.
+ * @return The list of tiles covering the window.
+ */
+std::vector<Tile> generate_tiles(const Window& window, const uint32_t& tile_size, const TileOrder& order);
+
+/**
+ * @brief Persistent pool of worker threads rendering tiles.
+ *
+ * The threads are created once and sleep between render passes. For each pass
+ * the tiles are dealt round robin in per worker deques: a worker pops its own
+ * tiles from the front, and steals from the back of the other deques once its
+ * own deque is empty. The calling thread takes part in the work as worker 0.
+ */
+class Scheduler {
+public:
+    /**
+     * @brief Function called for each tile.
+     * @param tile The tile to render.
+     * @param worker_id Index of the worker rendering the tile, in [0, thread_count()).
+     */
+    using TileFunction = std::function<void(const Tile& tile, const uint32_t& worker_id)>;
+
+    /**
+     * @brief Constructor.
+     * @param n_threads Number of threads, 0 uses all the hardware threads.
+     */
+    Scheduler(const uint32_t& n_threads = 0);
+
+    ~Scheduler();
+
+    /**
+     * @brief Change the number of threads of the pool.
+     * Must not be called while a pass is running.
+     * @param n_threads Number of threads, 0 uses all the hardware threads.
+     */
+    void set_threads(const uint32_t& n_threads);
+
+    /**
+     * @brief Number of threads rendering tiles (calling thread included).
+     */
+    uint32_t thread_count() const { return (uint32_t)workers.size(); }
+
+    /**
+     * @brief Tiles of a w x h image with the current tile size and order.
+     * The list is cached and only rebuilt when one of the settings changes.
+     */
+    const std::vector<Tile>& tiles(const uint32_t& w, const uint32_t& h);
+
+    /**
+     * @brief Tiles of a window of an image with the current tile size and order.
+     * The list is cached and only rebuilt when one of the settings changes.
+     */
+    const std::vector<Tile>& tiles(const Window& window);
+
+    /**
+     * @brief Tiles of a w x h image that are still active, in dispatch order.
+     * All the tiles are active when the tile list is (re)built.
+     */
+    const std::vector<Tile>& active_tiles(const uint32_t& w, const uint32_t& h);
+
+    /**
+     * @brief Tiles of a window of an image that are still active, in dispatch order.
+     */
+    const std::vector<Tile>& active_tiles(const Window& window);
+
+    /**
+     * @brief Enable or disable the rendering of a tile.
+     * @param id Index of the tile in the row major tile grid (Tile::id).
+     * @param active False to skip the tile in active_tiles().
+     */
+    void set_tile_active(const uint32_t& id, const bool& active);
+
+    /**
+     * @brief Enable the rendering of all the tiles.
+     */
+    void activate_all_tiles();
+
+    /**
+     * @brief Render all the tiles and return once they are all done.
+     * @param tiles The tiles to render.
+     * @param f The function rendering a tile.
+     */
+    void run(const std::vector<Tile>& tiles, const TileFunction& f);
+
+    uint32_t tile_size; /**< Size of the side of a tile in pixels. */
+    TileOrder tile_order; /**< Dispatch order of the tiles. */
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<uint32_t> queue; /**< Indices of the tiles left to this worker. */
+    };
+
+    void start(const uint32_t& n_threads);
+    void stop();
+    void worker_loop(const uint32_t& worker_id, uint64_t seen);
+    void execute(const uint32_t& worker_id);
+    bool next_tile(const uint32_t& worker_id, uint32_t& tile_idx);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    uint64_t generation;
+    uint32_t running;
+    bool quit;
+
+    const std::vector<Tile>* job_tiles;
+    const TileFunction* job;
+
+    std::vector<Tile> cached_tiles;
+    std::vector<Tile> cached_active_tiles;
+    std::vector<uint8_t> tile_active; /**< Activity of each tile, indexed by Tile::id. */
+    bool active_dirty;
+    Window cached_window;
+    uint32_t cached_tile_size;
+    TileOrder cached_tile_order;
+};
+
+} // namespace LT_NAMESPACE
@@ -2,6 +2,36 @@
 
 namespace LT_NAMESPACE {
 
+/////////////////////
+// Film tile
+///////////////////
+
+void FilmTile::reset(const Tile& t, const uint32_t& guard, const Sensor& sensor)
+{
+    tile = t;
+    tile.x_min = t.x_min > guard ? t.x_min - guard : 0;
+    tile.y_min = t.y_min > guard ? t.y_min - guard : 0;
+    tile.x_max = std::min(t.x_max + guard, sensor.w);
+    tile.y_max = std::min(t.y_max + guard, sensor.h);
+    guard_band = guard;
+    w = tile.x_max - tile.x_min;
+
+    uint32_t n = w * (tile.y_max - tile.y_min);
+    sum.assign(n, Spectrum(0.));
+    sum_sqr.assign(n, Spectrum(0.));
+    weight.assign(n, 0.);
+    count.assign(n, 0);
+    total_count = 0;
+
+    aovs = sensor.aovs;
+    if (aovs) {
+        albedo.assign(n, Spectrum(0.));
+        normal.assign(n, vec3(0.));
+        depth.assign(n, 0.);
+        geometry_id.assign(n, -1);
+    }
+}
+
 /////////////////////
 // Sensor Factory
 ///////////////////
@@ -18,26 +48,87 @@ Factory<Sensor>::CreatorRegistry& Factory<Sensor>::registry()
 }
 
 void Sensor::init() {
-    value.resize(w * h);
-    acculumator.resize(w * h);
-    count.resize(w * h);
+    size_t n = streamed ? 0 : size_t(w) * size_t(h);
+    value.init(n, value_precision(precision));
+    acculumator.init(n, accumulator_precision(precision));
+    weight.assign(n, 0.);
+    weight.shrink_to_fit();
+    count.assign(n, 0);
+    count.shrink_to_fit();
+
+    size_t n_aov = aovs ? n : 0;
+    aov_albedo.assign(n_aov, Spectrum(0.));
+    aov_normal.assign(n_aov, vec3(0.));
+    aov_depth.assign(n_aov, 0.);
+    aov_geometry_id.assign(n_aov, -1);
+
+    epoch = 0;
+    cleared_epoch = 0;
+    pixel_epoch.assign(n, 0);
+    pixel_epoch.shrink_to_fit();
+
     u = linspace<Float>(-1, 1, w);
     v = linspace<Float>(1, -1, h);
     sum_counts = 0;
+    dirty = false;
 }
 
-/**
-    * @brief Resets the sensor data.
-    *
-    * This function resets the accumulator, value, and count arrays of the
-    * sensor.
-    */
 void Sensor::reset()
 {
-    memset(acculumator.data(), 0, sizeof(Spectrum) * acculumator.size());
-    memset(value.data(), 0, sizeof(Spectrum) * value.size());
-    memset(count.data(), 0, sizeof(uint16_t) * count.size());
+    // After 2^32 resets, pixels left untouched since could look fresh again
+    if (++epoch == 0) {
+        for (uint32_t idx = 0; idx < pixel_epoch.size(); idx++)
+            clear_pixel(idx);
+        std::fill(pixel_epoch.begin(), pixel_epoch.end(), 0);
+        cleared_epoch = 0;
+    }
     sum_counts = 0;
+    // The stale values are resolved to zero
+    dirty = true;
+}
+
+void Sensor::clear_stale()
+{
+    if (cleared_epoch == epoch)
+        return;
+    for (uint32_t idx = 0; idx < pixel_epoch.size(); idx++)
+        touch(idx);
+    cleared_epoch = epoch;
+}
+
+bool Sensor::set_crop(const Window& window)
+{
+    if (window.width() == 0 && window.height() == 0) {
+        crop = window;
+        return true;
+    }
+    if (window.width() == 0 || window.height() == 0 || window.x_max > w || window.y_max > h) {
+        Log(logError) << "Sensor::set_crop: [" << window.x_min << ", " << window.y_min << ", " << window.x_max << ", " << window.y_max
+                      << "] is not a window of the " << w << "x" << h << " sensor";
+        return false;
+    }
+    crop = window;
+    return true;
+}
+
+Window Sensor::window() const
+{
+    if (crop.width() == 0 || crop.height() == 0)
+        return Window { 0, 0, w, h };
+    return Window { std::min(crop.x_min, w), std::min(crop.y_min, h), std::min(crop.x_max, w), std::min(crop.y_max, h) };
+}
+
+void Sensor::clear_pixel(const uint32_t& idx)
+{
+    acculumator.set(idx, Spectrum(0.));
+    weight[idx] = 0.;
+    count[idx] = 0;
+    if (!aov_albedo.empty()) {
+        aov_albedo[idx] = Spectrum(0.);
+        aov_normal[idx] = vec3(0.);
+        aov_depth[idx] = 0.;
+        aov_geometry_id[idx] = -1;
+    }
 }
 
 /**
@@ -50,10 +141,175 @@ void Sensor::reset()
 void Sensor::add(const uint32_t& x, const uint32_t& y, Spectrum s)
 {
     uint32_t idx = y * w + x;
-    acculumator[idx] += s;
+    touch(idx);
+    acculumator.add(idx, s);
+    weight[idx] += 1.;
     count[idx]++;
     sum_counts++;
-    set_value(idx,y);
+    dirty.store(true, std::memory_order_relaxed);
+}
+
+/**
+    * @brief Adds a batch of samples to the sensor data.
+    *
+    * @param x The x-coordinate of the samples.
+    * @param y The y-coordinate of the samples.
+    * @param sum The sum of the spectrums of the samples.
+    * @param sum_sqr The sum of the squared spectrums of the samples (unused).
+    * @param n The number of samples.
+    */
+void Sensor::add(const uint32_t& x, const uint32_t& y, const Spectrum& sum, const Spectrum& sum_sqr, const uint32_t& n)
+{
+    uint32_t idx = y * w + x;
+    touch(idx);
+    acculumator.add(idx, sum);
+    weight[idx] += (Float)n;
+    count[idx] += n;
+    sum_counts += n;
+    dirty.store(true, std::memory_order_relaxed);
+}
+
+void Sensor::merge(const FilmTile& film)
+{
+    if (film.guard_band == 0) {
+        touch_rows(film, film.tile.y_min, film.tile.y_max);
+        merge_rows(film, film.tile.y_min, film.tile.y_max);
+        merge_aov_rows(film, film.tile.y_min, film.tile.y_max);
+    } else {
+        for (uint32_t y = film.tile.y_min; y < film.tile.y_max; y++) {
+            std::lock_guard<std::mutex> lock(merge_mutex[y % merge_mutex.size()]);
+            touch_rows(film, y, y + 1);
+            merge_rows(film, y, y + 1);
+            merge_aov_rows(film, y, y + 1);
+        }
+    }
+    sum_counts += film.total_count;
+    dirty.store(true, std::memory_order_relaxed);
+}
+
+void Sensor::merge(const Sensor& other)
+{
+    if (other.w != w || other.h != h || other.acculumator.size() != acculumator.size()) {
+        Log(logError) << "Sensor::merge: the sensors have different sizes";
+        return;
+    }
+    clear_stale();
+    merge_pixels(other);
+    sum_counts += other.sum_counts;
+    dirty.store(true, std::memory_order_relaxed);
+}
+
+void Sensor::merge_pixels(const Sensor& other)
+{
+    for (uint32_t idx = 0; idx < acculumator.size(); idx++) {
+        if (!other.fresh(idx))
+            continue;
+        acculumator.add(idx, other.acculumator.get(idx));
+        weight[idx] += other.weight[idx];
+        count[idx] += other.count[idx];
+    }
+
+    if (aov_albedo.empty() || other.aov_albedo.empty())
+        return;
+
+    for (uint32_t idx = 0; idx < aov_albedo.size(); idx++) {
+        if (!other.fresh(idx))
+            continue;
+        aov_albedo[idx] += other.aov_albedo[idx];
+        aov_normal[idx] += other.aov_normal[idx];
+        aov_depth[idx] += other.aov_depth[idx];
+        if (aov_geometry_id[idx] < 0)
+            aov_geometry_id[idx] = other.aov_geometry_id[idx];
+    }
+}
+
+void Sensor::merge_rows(const FilmTile& film, const uint32_t& y_min, const uint32_t& y_max)
+{
+    for (uint32_t y = y_min; y < y_max; y++) {
+        for (uint32_t x = film.tile.x_min; x < film.tile.x_max; x++) {
+            uint32_t idx = y * w + x;
+            uint32_t f_idx = (y - film.tile.y_min) * film.w + (x - film.tile.x_min);
+            if (film.weight[f_idx] == 0 && film.count[f_idx] == 0)
+                continue;
+            acculumator.add(idx, film.sum[f_idx]);
+            weight[idx] += film.weight[f_idx];
+            count[idx] += film.count[f_idx];
+        }
+    }
+}
+
+void Sensor::touch_rows(const FilmTile& film, const uint32_t& y_min, const uint32_t& y_max)
+{
+    for (uint32_t y = y_min; y < y_max; y++)
+        for (uint32_t x = film.tile.x_min; x < film.tile.x_max; x++)
+            touch(y * w + x);
+}
+
+void Sensor::merge_aov_rows(const FilmTile& film, const uint32_t& y_min, const uint32_t& y_max)
+{
+    if (!film.aovs || aov_albedo.empty())
+        return;
+
+    for (uint32_t y = y_min; y < y_max; y++) {
+        for (uint32_t x = film.tile.x_min; x < film.tile.x_max; x++) {
+            uint32_t idx = y * w + x;
+            uint32_t f_idx = (y - film.tile.y_min) * film.w + (x - film.tile.x_min);
+            aov_albedo[idx] += film.albedo[f_idx];
+            aov_normal[idx] += film.normal[f_idx];
+            aov_depth[idx] += film.depth[f_idx];
+            if (aov_geometry_id[idx] < 0)
+                aov_geometry_id[idx] = film.geometry_id[f_idx];
+        }
+    }
+}
+
+void Sensor::resolve()
+{
+    if (!dirty.exchange(false))
+        return;
+    resolve_values();
+}
+
+inline void store_value(float& dst, const Float& v) { dst = v; }
+inline void store_value(uint16_t& dst, const Float& v) { dst = float_to_half(v); }
+
+/**
+ * @brief Calls kernel(a0, a1, a2, v0, v1, v2) with typed pointers on the planes
+ * of the accumulator and of the values. The precision switch is done once here
+ * so that the loops of the kernels can be vectorized.
+ */
+template<typename Kernel>
+void with_planes(const FilmPlanes& acc, FilmPlanes& value, const Kernel& kernel)
+{
+    if (acc.precision == FilmPrecision::Double)
+        kernel(acc.plane<double>(0), acc.plane<double>(1), acc.plane<double>(2),
+            value.plane<float>(0), value.plane<float>(1), value.plane<float>(2));
+    else if (value.precision == FilmPrecision::Half)
+        kernel(acc.plane<float>(0), acc.plane<float>(1), acc.plane<float>(2),
+            value.plane<uint16_t>(0), value.plane<uint16_t>(1), value.plane<uint16_t>(2));
+    else
+        kernel(acc.plane<float>(0), acc.plane<float>(1), acc.plane<float>(2),
+            value.plane<float>(0), value.plane<float>(1), value.plane<float>(2));
+}
+
+void Sensor::resolve_values()
+{
+    const size_t n = value.size();
+    const Float* wgt = weight.data();
+    const uint32_t* pix_epoch = pixel_epoch.data();
+    const uint32_t cur = epoch;
+
+    with_planes(acculumator, value, [&](const auto* a0, const auto* a1, const auto* a2, auto* v0, auto* v1, auto* v2) {
+        for (size_t idx = 0; idx < n; idx++) {
+            // Stale pixels are masked arithmetically rather than skipped, and
+            // the division is safe on every lane, to keep the loop branchless
+            Float live = Float((pix_epoch[idx] == cur) & (wgt[idx] > 0));
+            Float inv_weight = live / (wgt[idx] * live + (1.f - live));
+            store_value(v0[idx], Float(a0[idx]) * inv_weight);
+            store_value(v1[idx], Float(a1[idx]) * inv_weight);
+            store_value(v2[idx], Float(a2[idx]) * inv_weight);
+        }
+    });
 }
 
 /**
@@ -66,13 +322,17 @@ void Sensor::add(const uint32_t& x, const uint32_t& y, Spectrum s)
 void Sensor::set(const uint32_t& x, const uint32_t& y, Spectrum s)
 {
     uint32_t idx = y * w + x;
-    acculumator[idx] = s;
+    touch(idx);
+    acculumator.set(idx, s);
+    weight[idx] = 1.;
     count[idx] = 1;
-    set_value(idx,y);
+    dirty.store(true, std::memory_order_relaxed);
 }
 
 Spectrum Sensor::get(const uint32_t& x, const uint32_t& y) {
-    return value[y * w + x];
+    uint32_t idx = y * w + x;
+    set_value(idx, y);
+    return value.get(idx);
 }
 
 /**
@@ -82,17 +342,52 @@ Spectrum Sensor::get(const uint32_t& x, const uint32_t& y) {
     * @param y The y-coordinate of the pixel.
     * @return The number of samples at the specified pixel.
     */
-uint16_t Sensor::n_sample(const uint32_t& x, const uint32_t& y)
+uint32_t Sensor::n_sample(const uint32_t& x, const uint32_t& y)
 {
-    return count[y * w + x];
+    uint32_t idx = y * w + x;
+    return fresh(idx) ? count[idx] : 0;
 }
 
-void Sensor::set_value(const uint32_t& idx, const uint32_t& x){
-    value[idx] = acculumator[idx] / (Float)count[idx];
-    assert(value[idx] == value[idx]);
+void Sensor::set_value(const uint32_t& idx, const uint32_t& y){
+    Float inv_weight = fresh(idx) && weight[idx] > 0 ? 1.f / weight[idx] : 0.f;
+    value.set(idx, acculumator.get(idx) * inv_weight);
 }
 
+void VarianceSensor::resolve_values()
+{
+    if (!output_variance) {
+        Sensor::resolve_values();
+        return;
+    }
 
+    const size_t n = value.size();
+    const Float* wgt = weight.data();
+    const uint32_t* cnt = count.data();
+    const uint32_t* pix_epoch = pixel_epoch.data();
+    const uint32_t cur = epoch;
+
+    with_planes(acculumator, value, [&](const auto* a0, const auto* a1, const auto* a2, auto* v0, auto* v1, auto* v2) {
+        // The squared sums have the precision of the sums
+        using Acc = std::remove_cv_t<std::remove_pointer_t<decltype(a0)>>;
+        const Acc* s0 = acculumator_sqr.plane<Acc>(0);
+        const Acc* s1 = acculumator_sqr.plane<Acc>(1);
+        const Acc* s2 = acculumator_sqr.plane<Acc>(2);
+
+        for (size_t idx = 0; idx < n; idx++) {
+            Float live = Float((pix_epoch[idx] == cur) & (wgt[idx] > 0));
+            Float inv_weight = live / (wgt[idx] * live + (1.f - live));
+            Float c = (Float)cnt[idx];
+            Float several = Float(c > 1);
+            Float inv_n_1 = several / ((c - 1.f) * several + (1.f - several));
+            Float m0 = Float(a0[idx]) * inv_weight;
+            Float m1 = Float(a1[idx]) * inv_weight;
+            Float m2 = Float(a2[idx]) * inv_weight;
+            store_value(v0[idx], (Float(s0[idx]) * inv_weight - m0 * m0) * inv_n_1);
+            store_value(v1[idx], (Float(s1[idx]) * inv_weight - m1 * m1) * inv_n_1);
+            store_value(v2[idx], (Float(s2[idx]) * inv_weight - m2 * m2) * inv_n_1);
+        }
+    });
+}
 
 void HemisphereSensor::init() {
     Sensor::init();
@@ -110,7 +405,29 @@ void HemisphereSensor::init() {
 
 void HemisphereSensor::set_value(const uint32_t& idx, const uint32_t& y) {
     Float norm = sum_counts * solid_angle[y];
-    value[idx] = acculumator[idx] / norm;
+    value.set(idx, fresh(idx) && norm > 0 ? acculumator.get(idx) / norm : Spectrum(0.));
+}
+
+void HemisphereSensor::resolve_values() {
+    const uint32_t* pix_epoch = pixel_epoch.data();
+    const uint32_t cur = epoch;
+    const Float counts = Float(sum_counts);
+    const size_t width = w;
+
+    with_planes(acculumator, value, [&](const auto* a0, const auto* a1, const auto* a2, auto* v0, auto* v1, auto* v2) {
+        // The normalization only depends on the row
+        for (uint32_t y = 0; y < h; y++) {
+            Float norm = counts * solid_angle[y];
+            Float inv_norm = norm > 0 ? 1.f / norm : 0.f;
+            const size_t row_end = (y + 1) * width;
+            for (size_t idx = y * width; idx < row_end; idx++) {
+                Float scale = pix_epoch[idx] == cur ? inv_norm : 0.f;
+                store_value(v0[idx], Float(a0[idx]) * scale);
+                store_value(v1[idx], Float(a1[idx]) * scale);
+                store_value(v2[idx], Float(a2[idx]) * scale);
+            }
+        }
+    });
 }
 
 }
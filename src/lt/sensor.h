@@ -5,14 +5,128 @@
 
 #pragma once
 #include <lt/lt_common.h>
+#include <lt/brdf/brdf.h>
 #include <lt/serialize.h>
 #include <lt/factory.h>
-#include <atomic>
+#include <lt/film.h>
+#include <lt/filter.h>
+#include <lt/scheduler.h>
 
+#include <array>
 #include <atomic>
+#include <mutex>
 
 namespace LT_NAMESPACE {
 
+class Sensor;
+
+/**
+ * @brief Private accumulation buffer of a tile of pixels.
+ *
+ * A worker adds the samples of the tile it renders to its own FilmTile, which
+ * is then merged into the Sensor in one go, see Sensor::merge(). With a
+ * reconstruction filter the buffer extends past the tile by a guard band
+ * receiving the samples splatted on the neighbouring pixels.
+ */
+class FilmTile {
+public:
+    /**
+     * @brief Resize the buffer to a tile and clear it.
+     * @param t The tile rendered in the buffer.
+     * @param guard_band Number of pixels added on each side of the tile.
+     * @param sensor The sensor the buffer is merged in, the buffer is clamped
+     * to its size and records the AOVs if the sensor does.
+     */
+    void reset(const Tile& t, const uint32_t& guard_band, const Sensor& sensor);
+
+    /**
+     * @brief Adds a batch of samples to a pixel of the tile.
+     *
+     * @param x The x-coordinate of the samples, in the sensor.
+     * @param y The y-coordinate of the samples, in the sensor.
+     * @param s The sum of the spectrums of the samples.
+     * @param s_sqr The sum of the squared spectrums of the samples.
+     * @param n The number of samples.
+     */
+    void add(const uint32_t& x, const uint32_t& y, const Spectrum& s, const Spectrum& s_sqr, const uint32_t& n)
+    {
+        uint32_t idx = (y - tile.y_min) * w + (x - tile.x_min);
+        sum[idx] += s;
+        sum_sqr[idx] += s_sqr;
+        weight[idx] += (Float)n;
+        count[idx] += n;
+        total_count += n;
+    }
+
+    /**
+     * @brief Splats a sample on the pixels in the support of a filter.
+     *
+     * @param x The x-coordinate of the pixel of the sample, in the sensor.
+     * @param y The y-coordinate of the pixel of the sample, in the sensor.
+     * @param pos The position of the sample, in pixels.
+     * @param s The spectrum of the sample.
+     * @param filter The reconstruction filter.
+     */
+    void splat(const uint32_t& x, const uint32_t& y, const vec2& pos, const Spectrum& s, const Filter& filter)
+    {
+        int x0 = std::max((int)std::ceil(pos.x - filter.radius), (int)tile.x_min);
+        int x1 = std::min((int)std::floor(pos.x + filter.radius), (int)tile.x_max - 1);
+        int y0 = std::max((int)std::ceil(pos.y - filter.radius), (int)tile.y_min);
+        int y1 = std::min((int)std::floor(pos.y + filter.radius), (int)tile.y_max - 1);
+
+        Spectrum s_sqr = s * s;
+        for (int py = y0; py <= y1; py++) {
+            for (int px = x0; px <= x1; px++) {
+                Float f = filter.eval(pos - vec2(px, py));
+                uint32_t idx = (py - tile.y_min) * w + (px - tile.x_min);
+                sum[idx] += f * s;
+                sum_sqr[idx] += f * s_sqr;
+                weight[idx] += f;
+            }
+        }
+
+        count[(y - tile.y_min) * w + (x - tile.x_min)]++;
+        total_count++;
+    }
+
+    /**
+     * @brief Adds the first hit of a camera ray to the AOVs of a pixel.
+     *
+     * @param x The x-coordinate of the pixel of the sample, in the sensor.
+     * @param y The y-coordinate of the pixel of the sample, in the sensor.
+     * @param hit True if the camera ray hits the scene.
+     * @param si The first hit of the camera ray.
+     */
+    void add_aovs(const uint32_t& x, const uint32_t& y, const bool& hit, const SurfaceInteraction& si)
+    {
+        // Misses leave the AOVs at zero
+        if (!hit)
+            return;
+
+        uint32_t idx = (y - tile.y_min) * w + (x - tile.x_min);
+        albedo[idx] += si.brdf ? si.brdf->reflectance(si) : Spectrum(0.);
+        normal[idx] += si.nor;
+        depth[idx] += si.t;
+        if (geometry_id[idx] < 0)
+            geometry_id[idx] = (int32_t)si.geom_id;
+    }
+
+    Tile tile; /**< Pixels covered by the buffer, guard band included. */
+    uint32_t guard_band; /**< Number of pixels added on each side of the rendered tile. */
+    uint32_t w; /**< Width of the buffer. */
+    std::vector<Spectrum> sum; /**< Weighted sum of the samples of each pixel. */
+    std::vector<Spectrum> sum_sqr; /**< Weighted sum of the squared samples of each pixel. */
+    std::vector<Float> weight; /**< Sum of the filter weights of each pixel. */
+    std::vector<uint32_t> count; /**< Number of samples taken in each pixel. */
+    uint32_t total_count; /**< Number of samples of the tile. */
+
+    bool aovs; /**< True if the buffer records the AOVs. */
+    std::vector<Spectrum> albedo; /**< Sum of the albedo of the first hits of each pixel. */
+    std::vector<vec3> normal; /**< Sum of the normal of the first hits of each pixel. */
+    std::vector<Float> depth; /**< Sum of the distance to the first hits of each pixel. */
+    std::vector<int32_t> geometry_id; /**< Geometry of the first hit of each pixel, -1 if none. */
+};
+
 /**
  * @brief Class for handling sensor data.
  *
@@ -29,6 +143,12 @@ public:
         : Serializable(type)
         , w(w)
         , h(h)
+        , precision(FilmPrecision::Float)
+        , aovs(false)
+        , crop { 0, 0, 0, 0 }
+        , streamed(false)
+        , epoch(0)
+        , cleared_epoch(0)
     {
         link_params();
     }
@@ -42,6 +162,12 @@ public:
         : Serializable("Sensor")
         , w(w)
         , h(h)
+        , precision(FilmPrecision::Float)
+        , aovs(false)
+        , crop { 0, 0, 0, 0 }
+        , streamed(false)
+        , epoch(0)
+        , cleared_epoch(0)
     {
         link_params();
     }
@@ -51,11 +177,42 @@ public:
     /**
      * @brief Resets the sensor data.
      *
-     * This function resets the accumulator, value, and count arrays of the
-     * sensor.
+     * Only starts a new epoch : the pixels written before are stale, read as
+     * zero and cleared by their first write of the new epoch (see touch()).
+     * The buffers are not traversed, camera moves stay cheap at high resolution.
      */
     virtual void reset();
 
+    /**
+     * @brief Clears the stale pixels, so that the buffers can be read directly.
+     *
+     * The pixels that were not rendered since the last reset() are then zero.
+     * Called lazily by the consumers of the raw buffers (checkpoints, AOV
+     * export, merge), the others test fresh() instead. Returns at once when no
+     * reset() happened since the last call.
+     */
+    void clear_stale();
+
+    /**
+     * @brief Sets the crop window, the only pixels rendered.
+     *
+     * @param window The window, empty for the full frame.
+     * @return False if the window is not inside the sensor, the crop is then unchanged.
+     */
+    bool set_crop(const Window& window);
+
+    /**
+     * @brief Pixels rendered : the crop window, or the full frame without crop.
+     */
+    Window window() const;
+
+    /**
+     * @brief True if the pixel was written since the last reset().
+     *
+     * @param idx The index of the pixel.
+     */
+    bool fresh(const uint32_t& idx) const { return pixel_epoch[idx] == epoch; }
+
     /**
      * @brief Adds a sample to the sensor data.
      *
@@ -65,6 +222,47 @@ public:
      */
     virtual void add(const uint32_t& x, const uint32_t& y, Spectrum s);
 
+    /**
+     * @brief Adds a batch of samples to the sensor data.
+     *
+     * @param x The x-coordinate of the samples.
+     * @param y The y-coordinate of the samples.
+     * @param sum The sum of the spectrums of the samples.
+     * @param sum_sqr The sum of the squared spectrums of the samples.
+     * @param n The number of samples.
+     */
+    virtual void add(const uint32_t& x, const uint32_t& y, const Spectrum& sum, const Spectrum& sum_sqr, const uint32_t& n);
+
+    /**
+     * @brief Adds the samples of a tile buffer to the sensor data.
+     *
+     * Tiles that do not overlap can be merged concurrently. The guard bands
+     * of neighbouring tiles do, their rows are then merged under a lock
+     * picked among a few by row index.
+     *
+     * @param film The tile buffer.
+     */
+    void merge(const FilmTile& film);
+
+    /**
+     * @brief Adds the samples of another sensor of the same size to the sensor data.
+     *
+     * Used to combine renders of disjoint sample ranges of the same image,
+     * see save_checkpoint(). Not thread safe.
+     *
+     * @param other The sensor, of the same type, size and precision.
+     */
+    void merge(const Sensor& other);
+
+    /**
+     * @brief Computes the value of the pixels from the accumulated samples.
+     *
+     * Adding samples only updates the raw moments of the pixels, \ref value is
+     * resolved on demand (display, export) and only if samples were added
+     * since the last call.
+     */
+    void resolve();
+
     /**
      * @brief Sets a sample in the sensor data.
      *
@@ -74,6 +272,13 @@ public:
      */
     virtual void set(const uint32_t& x, const uint32_t& y, Spectrum s);
 
+    /**
+     * @brief Gets the resolved value of a pixel.
+     *
+     * @param x The x-coordinate of the pixel.
+     * @param y The y-coordinate of the pixel.
+     * @return The value of the pixel.
+     */
     virtual Spectrum get(const uint32_t& x, const uint32_t& y);
 
     /**
@@ -83,26 +288,98 @@ public:
      * @param y The y-coordinate of the pixel.
      * @return The number of samples at the specified pixel.
      */
-    uint16_t n_sample(const uint32_t& x, const uint32_t& y);
+    uint32_t n_sample(const uint32_t& x, const uint32_t& y);
 
-    virtual void set_value(const uint32_t& idx, const uint32_t& x);
+    /**
+     * @brief Resolves the value of a single pixel.
+     *
+     * @param idx The index of the pixel.
+     * @param y The y-coordinate of the pixel.
+     */
+    virtual void set_value(const uint32_t& idx, const uint32_t& y);
 
     uint32_t w; /**< Width of the sensor. */
     uint32_t h; /**< Height of the sensor. */
-    std::vector<Spectrum> acculumator; /**< Accumulator array for sensor samples. */
-    std::vector<Spectrum> value; /**< Value array for sensor samples. (accumulator[i] / count[i]) */
-    std::vector<uint16_t> count; /**< Count array for the number of samples at each pixel. */
-    std::atomic<uint32_t> sum_counts;
+    FilmPrecision precision; /**< Precision of the accumulators and values, applied by init(), see FilmPrecision. */
+    FilmPlanes acculumator; /**< Accumulator array for sensor samples, float or double. */
+    FilmPlanes value; /**< Value array for sensor samples (accumulator[i] / weight[i]), half or float, see resolve(). */
+    std::vector<Float> weight; /**< Sum of the filter weights of each pixel, equal to count without filter. */
+    std::vector<uint32_t> count; /**< Count array for the number of samples at each pixel. */
+    std::atomic<uint64_t> sum_counts; /**< Number of samples of the whole sensor. */
+    std::atomic<bool> dirty; /**< True if samples were added since the last resolve(). */
     std::vector<Float> u; /**< Vector representing the u-coordinates of the sensor pixels. */
     std::vector<Float> v; /**< Vector representing the v-coordinates of the sensor pixels. */
+    std::shared_ptr<Filter> filter; /**< Reconstruction filter, nullptr to add each sample to its pixel only. */
+
+    bool aovs; /**< Capture the AOVs of the first hit of the camera rays, applied by init(). */
+    std::vector<Spectrum> aov_albedo; /**< Sum of the albedo of the first hits of each pixel. */
+    std::vector<vec3> aov_normal; /**< Sum of the normal of the first hits of each pixel. */
+    std::vector<Float> aov_depth; /**< Sum of the distance to the first hits of each pixel. */
+    std::vector<int32_t> aov_geometry_id; /**< Geometry of the first hit of each pixel, -1 if none. */
 
+    Window crop; /**< Crop window in pixels, empty for the full frame, see window(). The camera still maps the full frame. */
+
+    bool streamed; /**< The pixels are streamed to a file tile by tile, see Integrator::render_tile_major(). init() then leaves the per pixel buffers empty. */
 
 protected:
+    /**
+     * @brief Clears a stale pixel before its first write of the epoch.
+     *
+     * @param idx The index of the pixel.
+     */
+    void touch(const uint32_t& idx)
+    {
+        if (pixel_epoch[idx] != epoch) {
+            clear_pixel(idx);
+            pixel_epoch[idx] = epoch;
+        }
+    }
+
+    /**
+     * @brief Sets the accumulators of a pixel to zero, called by touch().
+     *
+     * @param idx The index of the pixel.
+     */
+    virtual void clear_pixel(const uint32_t& idx);
+
+    uint32_t epoch; /**< Incremented by reset(). */
+    uint32_t cleared_epoch; /**< Epoch of the last clear_stale(), no pixel is stale while it is the current one. */
+    std::vector<uint32_t> pixel_epoch; /**< Epoch of the last write of each pixel, stale if not the current one. */
+
+    /**
+     * @brief Resolves the value of all the pixels, called by resolve().
+     */
+    virtual void resolve_values();
+
+    /**
+     * @brief Adds rows of a tile buffer to the sensor data, called by merge().
+     *
+     * @param film The tile buffer.
+     * @param y_min First row to add.
+     * @param y_max Last row to add (excluded).
+     */
+    virtual void merge_rows(const FilmTile& film, const uint32_t& y_min, const uint32_t& y_max);
+
+    /**
+     * @brief Adds the accumulators of another sensor, called by merge().
+     *
+     * @param other The sensor.
+     */
+    virtual void merge_pixels(const Sensor& other);
+
+    std::array<std::mutex, 64> merge_mutex; /**< Locks of the rows shared by several tile buffers. */
+
     void link_params()
     {
         params.add("width", &w);
         params.add("height", &h);
+        params.add("aovs", &aovs);
+        params.add("streamed", &streamed);
     }
+
+private:
+    void touch_rows(const FilmTile& film, const uint32_t& y_min, const uint32_t& y_max);
+    void merge_aov_rows(const FilmTile& film, const uint32_t& y_min, const uint32_t& y_max);
 };
 
 class VarianceSensor : public Sensor
@@ -110,63 +387,132 @@ class VarianceSensor : public Sensor
 public:
 
     VarianceSensor()
-        : Sensor("Variance")
-    {};
+        : Sensor("VarianceSensor")
+        , output_variance(true)
+    {
+        link_params();
+    };
 
     VarianceSensor(const uint32_t& w, const uint32_t& h)
-        : Sensor("Variance", w, h)
-    {};
+        : Sensor("VarianceSensor", w, h)
+        , output_variance(true)
+    {
+        link_params();
+    };
 
     void init() {
         Sensor::init();
-        acculumator_sqr.resize(w * h);
-    }
-    
-    void reset() {
-        Sensor::reset();
-        memset(acculumator_sqr.data(), 0, sizeof(Spectrum) * acculumator_sqr.size());
+        acculumator_sqr.init(streamed ? 0 : w * h, accumulator_precision(precision));
     }
     
     void add(const uint32_t& x, const uint32_t& y, Spectrum s) 
     {
         uint32_t idx = y * w + x;
-        acculumator[idx] += s;
-        acculumator_sqr[idx] += s*s;
+        touch(idx);
+        acculumator.add(idx, s);
+        acculumator_sqr.add(idx, s * s);
+        weight[idx] += 1.;
         count[idx]++;
         sum_counts++;
-        set_value(idx, y);
+        dirty.store(true, std::memory_order_relaxed);
+    }
+
+    void add(const uint32_t& x, const uint32_t& y, const Spectrum& sum, const Spectrum& sum_sqr, const uint32_t& n)
+    {
+        uint32_t idx = y * w + x;
+        touch(idx);
+        acculumator.add(idx, sum);
+        acculumator_sqr.add(idx, sum_sqr);
+        weight[idx] += (Float)n;
+        count[idx] += n;
+        sum_counts += n;
+        dirty.store(true, std::memory_order_relaxed);
     }
 
     void set(const uint32_t& x, const uint32_t& y, Spectrum s)
     {
         uint32_t idx = y * w + x;
-        acculumator[idx] = s;
-        acculumator_sqr[idx] = s*s;
+        touch(idx);
+        acculumator.set(idx, s);
+        acculumator_sqr.set(idx, s * s);
+        weight[idx] = 1.;
         count[idx] = 1;
-        set_value(idx, y);
+        dirty.store(true, std::memory_order_relaxed);
     }
 
     void set_value(const uint32_t& idx, const uint32_t& y)
     {
-        Spectrum mean = acculumator[idx] / (Float)count[idx];
-        value[idx] = acculumator_sqr[idx] / (Float)count[idx] - mean * mean;
-        value[idx] = value[idx] / ((Float)count[idx] - 1);
-        assert(value[idx] == value[idx]);
+        value.set(idx, resolve_pixel(idx));
     }
 
     void use_variance(const bool& mode ) {
-        if (mode) {
-            for (int i = 0; i < acculumator.size(); i++)
-                set_value(i, 0);
-        }
-        else {
-            for (int i = 0; i < acculumator.size(); i++)
-                value[i] = acculumator[i] / (Float)count[i];
+        output_variance = mode;
+        dirty = true;
+        resolve();
+    }
+
+    FilmPlanes acculumator_sqr; /**< Accumulator array for the squared samples. */
+    bool output_variance; /**< Value holds the variance of the mean if true, the mean otherwise. */
+
+protected:
+    /**
+     * @brief Mean of the samples of a pixel, or variance of the mean if output_variance is set.
+     * Pixels with too few samples are black.
+     */
+    Spectrum resolve_pixel(const uint32_t& idx) const
+    {
+        if (!fresh(idx))
+            return Spectrum(0.);
+
+        Float inv_weight = weight[idx] > 0 ? 1.f / weight[idx] : 0.f;
+        Spectrum mean = acculumator.get(idx) * inv_weight;
+        if (!output_variance)
+            return mean;
+
+        Float n = (Float)count[idx];
+        Float inv_n_1 = n > 1 ? 1.f / (n - 1) : 0.f;
+        return (acculumator_sqr.get(idx) * inv_weight - mean * mean) * inv_n_1;
+    }
+
+    void merge_rows(const FilmTile& film, const uint32_t& y_min, const uint32_t& y_max)
+    {
+        for (uint32_t y = y_min; y < y_max; y++) {
+            for (uint32_t x = film.tile.x_min; x < film.tile.x_max; x++) {
+                uint32_t idx = y * w + x;
+                uint32_t f_idx = (y - film.tile.y_min) * film.w + (x - film.tile.x_min);
+                if (film.weight[f_idx] == 0 && film.count[f_idx] == 0)
+                    continue;
+                acculumator.add(idx, film.sum[f_idx]);
+                acculumator_sqr.add(idx, film.sum_sqr[f_idx]);
+                weight[idx] += film.weight[f_idx];
+                count[idx] += film.count[f_idx];
+            }
         }
     }
 
-    std::vector<Spectrum> acculumator_sqr;
-    
+    void clear_pixel(const uint32_t& idx)
+    {
+        Sensor::clear_pixel(idx);
+        acculumator_sqr.set(idx, Spectrum(0.));
+    }
+
+    void merge_pixels(const Sensor& other)
+    {
+        Sensor::merge_pixels(other);
+        const VarianceSensor* vs = dynamic_cast<const VarianceSensor*>(&other);
+        if (!vs)
+            return;
+        for (uint32_t idx = 0; idx < acculumator_sqr.size(); idx++)
+            if (vs->fresh(idx))
+                acculumator_sqr.add(idx, vs->acculumator_sqr.get(idx));
+    }
+
+    void resolve_values();
+
+    void link_params()
+    {
+        params.add("output_variance", &output_variance);
+    }
 
 };
 
@@ -194,6 +540,8 @@ public:
     Float dtheta;
     Float dphi;
 
+protected:
+    void resolve_values();
 };
 
 
@@ -0,0 +1,621 @@
+/**
+ * @file
+ * @brief Definition of the WavefrontPathIntegrator class.
+ */
+
+#pragma once
+#include <lt/integrator.h>
+
+namespace LT_NAMESPACE {
+
+/**
+ * @brief Path tracing integrator rendering the paths of several tiles in waves.
+ *
+ * The pixel samples of a batch of consecutive tiles are stored in SoA arrays
+ * of path states, one array per field, and each stage of the path tracer
+ * (camera rays, intersection, light sampling, shadow rays, MIS rays,
+ * continuation) runs over a whole queue of paths before the next one. Rays
+ * are traced with the Embree stream API. A wave holds about wave_size paths :
+ * the tiles are batched until they reach it, and the paths of a batch larger
+ * than wave_size are split in several waves.
+ *
+ * Each path draws its random numbers in the same order as in
+ * PathIntegrator::render_pixel(), so both integrators give the same image.
+ */
+class WavefrontPathIntegrator : public PathIntegrator {
+public:
+    WavefrontPathIntegrator()
+        : PathIntegrator("WavefrontPathIntegrator")
+        , wave_size(4096)
+    {
+        params.add("wave_size", &wave_size);
+    };
+
+    /**
+     * @brief Renders the scene, each worker of the scheduler rendering a
+     * batch of consecutive tiles at once.
+     * @param camera The camera used for rendering.
+     * @param sensor The sensor to capture the rendered image.
+     * @param scene The scene to render.
+     * @param sampler Unused, each pixel sample has its own random stream.
+     * @param scheduler The scheduler dispatching the batches on the worker threads.
+     * @return The time taken in milliseconds.
+     */
+    float render(std::shared_ptr<Camera> camera, std::shared_ptr<Sensor> sensor,
+        Scene& scene, Sampler& sampler, Scheduler& scheduler)
+    {
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        uint32_t guard_band = sensor->filter ? sensor->filter->guard_band() : 0;
+        uint32_t spp = std::max(spp_per_pass, 1u);
+        const std::vector<Tile>& tiles = scheduler.active_tiles(sensor->window());
+
+        // Enough tiles per batch to fill a wave
+        uint32_t tile_paths = std::max(scheduler.tile_size * scheduler.tile_size * spp, 1u);
+        uint32_t batch_size = std::max(wave_size / tile_paths, 1u);
+
+        // Each job of the scheduler is a batch, its id is the index of its first tile
+        std::vector<Tile> batches;
+        for (uint32_t i = 0; i < tiles.size(); i += batch_size)
+            batches.push_back(Tile { 0, 0, 0, 0, i });
+
+        // One tile buffer per tile of the batch of each worker
+        film_tiles.resize(scheduler.thread_count() * batch_size);
+
+        scheduler.run(batches,
+            [&](const Tile& batch, const uint32_t& worker_id) {
+                uint32_t n_tiles = std::min(batch_size, (uint32_t)tiles.size() - batch.id);
+                FilmTile* films = &film_tiles[worker_id * batch_size];
+                for (uint32_t k = 0; k < n_tiles; k++)
+                    films[k].reset(tiles[batch.id + k], guard_band, *sensor);
+
+                render_tiles(&tiles[batch.id], films, n_tiles, camera, sensor, scene, spp);
+
+                for (uint32_t k = 0; k < n_tiles; k++)
+                    sensor->merge(films[k]);
+            });
+
+        n_sample += spp;
+        auto t2 = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+    }
+
+    /**
+     * @brief Renders all the samples of a block of pixels as a wavefront,
+     * used by render_tile_major().
+     * @param tile The pixels to render.
+     * @param film The buffer receiving the samples of the tile.
+     * @param camera The camera used for rendering.
+     * @param sensor The sensor to capture the rendered image.
+     * @param scene The scene to render.
+     * @param spp The number of samples per pixel.
+     */
+    void render_block(const Tile& tile, FilmTile& film,
+        std::shared_ptr<Camera> camera,
+        std::shared_ptr<Sensor> sensor, Scene& scene, const uint32_t& spp)
+    {
+        render_tiles(&tile, &film, 1, camera, sensor, scene, spp);
+    }
+
+    /**
+     * @brief Renders all the samples of several blocks of pixels, in waves of
+     * at most wave_size paths.
+     * @param tiles The blocks of pixels to render.
+     * @param films The buffers receiving the samples of each block.
+     * @param n_tiles The number of blocks.
+     * @param camera The camera used for rendering.
+     * @param sensor The sensor to capture the rendered image.
+     * @param scene The scene to render.
+     * @param spp The number of samples per pixel.
+     */
+    void render_tiles(const Tile* tiles, FilmTile* films, const uint32_t& n_tiles,
+        std::shared_ptr<Camera> camera,
+        std::shared_ptr<Sensor> sensor, Scene& scene, const uint32_t& spp)
+    {
+        // Pixels of the blocks, the samples of a pixel are consecutive paths
+        Pixels pixels;
+        for (uint32_t k = 0; k < n_tiles; k++) {
+            for (uint32_t y = tiles[k].y_min; y < tiles[k].y_max; y++) {
+                for (uint32_t x = tiles[k].x_min; x < tiles[k].x_max; x++) {
+                    pixels.x.push_back(x);
+                    pixels.y.push_back(y);
+                    pixels.tile.push_back(k);
+                }
+            }
+        }
+
+        const Filter* filter = sensor->filter.get();
+        uint32_t n_pixel = (uint32_t)pixels.x.size();
+        uint32_t n_path = n_pixel * spp;
+        if (!filter) {
+            pixels.sum.assign(n_pixel, Spectrum(0.));
+            pixels.sum_sqr.assign(n_pixel, Spectrum(0.));
+        }
+
+        uint32_t wave = std::min(n_path, std::max(wave_size, 1u));
+        Paths paths;
+        Queues q;
+        q.active.reserve(wave);
+
+        for (uint32_t first = 0; first < n_path; first += wave) {
+            uint32_t count = std::min(wave, n_path - first);
+            paths.start(count);
+
+            // Camera rays
+            for (uint32_t i = 0; i < count; i++) {
+                uint32_t pixel = (first + i) / spp;
+
+                Sampler& sampler = paths.sampler[i];
+                sampler.start_pixel_sample(pixels.x[pixel], pixels.y[pixel], n_sample + (first + i) % spp);
+
+                Ray r = pixel_ray(*camera, *sensor, pixels.x[pixel], pixels.y[pixel], sampler, paths.film_pos[i]);
+                paths.ray_o[i] = r.o;
+                paths.ray_d[i] = r.d;
+                q.active.push_back(i);
+            }
+
+            bool coherent = true;
+            while (!q.active.empty()) {
+                trace_paths(paths, q, scene, coherent);
+
+                // The first wave holds the camera rays of all the paths
+                if (coherent && films[0].aovs) {
+                    for (uint32_t i = 0; i < q.active.size(); i++) {
+                        uint32_t p = q.active[i];
+                        uint32_t pixel = (first + p) / spp;
+                        bool hit = q.rayhits[i].hit.geomID != RTC_INVALID_GEOMETRY_ID;
+                        SurfaceInteraction si;
+                        if (hit) {
+                            si = paths.interaction(p);
+                            si.brdf = scene.geometries[paths.geom_id[p]]->brdf;
+                        }
+                        films[pixels.tile[pixel]].add_aovs(pixels.x[pixel], pixels.y[pixel], hit, si);
+                    }
+                }
+
+                shade_hits(paths, q, scene);
+                trace_shadows(paths, q, scene);
+                shade_direct(paths, q, scene);
+                trace_mis(paths, q, scene);
+                continue_paths(paths, q);
+
+                q.active.swap(q.next);
+                q.next.clear();
+                coherent = false;
+            }
+
+            for (uint32_t i = 0; i < count; i++) {
+                uint32_t pixel = (first + i) / spp;
+                const Spectrum& s = paths.radiance[i];
+                if (filter) {
+                    films[pixels.tile[pixel]].splat(pixels.x[pixel], pixels.y[pixel], paths.film_pos[i], s, *filter);
+                } else {
+                    pixels.sum[pixel] += s;
+                    pixels.sum_sqr[pixel] += s * s;
+                }
+            }
+        }
+
+        if (filter)
+            return;
+
+        for (uint32_t pixel = 0; pixel < n_pixel; pixel++)
+            films[pixels.tile[pixel]].add(pixels.x[pixel], pixels.y[pixel], pixels.sum[pixel], pixels.sum_sqr[pixel], spp);
+    }
+
+    uint32_t wave_size; /**< Number of paths traced together, several tiles are batched to reach it. */
+
+private:
+    /**
+     * @brief Pixels of a batch of tiles, and their samples summed over the waves.
+     */
+    struct Pixels {
+        std::vector<uint32_t> x;
+        std::vector<uint32_t> y;
+        std::vector<uint32_t> tile; /**< Index of the tile of the pixel in the batch. */
+        std::vector<Spectrum> sum; /**< Sum of the samples, without filter. */
+        std::vector<Spectrum> sum_sqr; /**< Sum of the squared samples, without filter. */
+    };
+
+    /**
+     * @brief State of the paths of a wave, one array per field (SoA).
+     */
+    struct Paths {
+        /**
+         * @brief Resize the arrays to n paths and start them at the camera.
+         */
+        void start(const uint32_t& n)
+        {
+            sampler.resize(n);
+            film_pos.resize(n);
+            ray_o.resize(n);
+            ray_d.resize(n);
+            throughput.assign(n, Spectrum(1.));
+            radiance.assign(n, Spectrum(0.));
+            depth.assign(n, 0);
+
+            pos.resize(n);
+            nor.resize(n);
+            tan.resize(n);
+            bitan.resize(n);
+            uv.resize(n);
+            t.resize(n);
+            geom_id.resize(n);
+            brdf.resize(n);
+
+            light.resize(n);
+            light_pdf.resize(n);
+            ls_direction.resize(n);
+            ls_emission.resize(n);
+            ls_pdf.resize(n);
+            wi.resize(n);
+            wo.resize(n);
+            bs_wo.resize(n);
+            bs_value.resize(n);
+            mis_light_pdf.resize(n);
+            direct.resize(n);
+        }
+
+        /**
+         * @brief Store the hit of a path.
+         */
+        void set_interaction(const uint32_t& p, const SurfaceInteraction& si)
+        {
+            pos[p] = si.pos;
+            nor[p] = si.nor;
+            tan[p] = si.tan;
+            bitan[p] = si.bitan;
+            uv[p] = si.uv;
+            t[p] = si.t;
+            geom_id[p] = si.geom_id;
+            brdf[p] = si.brdf.get();
+        }
+
+        /**
+         * @brief Hit of a path, without its BRDF (see brdf).
+         */
+        SurfaceInteraction interaction(const uint32_t& p) const
+        {
+            SurfaceInteraction si(pos[p], nor[p]);
+            si.tan = tan[p];
+            si.bitan = bitan[p];
+            si.tbn = glm::mat3(si.tan, si.bitan, si.nor);
+            si.inv_tbn = glm::transpose(si.tbn);
+            si.uv = uv[p];
+            si.t = t[p];
+            si.geom_id = geom_id[p];
+            return si;
+        }
+
+        std::vector<Sampler> sampler; /**< Random stream of the path. */
+        std::vector<vec2> film_pos; /**< Position of the camera sample, in pixels. */
+        std::vector<vec3> ray_o; /**< Origin of the ray of the current bounce. */
+        std::vector<vec3> ray_d; /**< Direction of the ray of the current bounce. */
+        std::vector<Spectrum> throughput; /**< Path throughput. */
+        std::vector<Spectrum> radiance; /**< Radiance gathered by the path. */
+        std::vector<uint32_t> depth; /**< Current bounce. */
+
+        // Hit of the current bounce (see SurfaceInteraction)
+        std::vector<vec3> pos;
+        std::vector<vec3> nor;
+        std::vector<vec3> tan;
+        std::vector<vec3> bitan;
+        std::vector<vec2> uv;
+        std::vector<Float> t;
+        std::vector<uint32_t> geom_id;
+        std::vector<Brdf*> brdf; /**< BRDF of the hit, owned by its geometry. */
+
+        // Direct lighting of the current bounce (see Integrator::sample_one_light())
+        std::vector<Light*> light; /**< Sampled light, owned by the scene. */
+        std::vector<Float> light_pdf; /**< Probability of choosing the light. */
+        std::vector<vec3> ls_direction; /**< Direction of the light sample. */
+        std::vector<Spectrum> ls_emission; /**< Emission of the light sample. */
+        std::vector<Float> ls_pdf; /**< Density of the light sample. */
+        std::vector<vec3> wi; /**< Local incident direction. */
+        std::vector<vec3> wo; /**< Local direction to the light sample. */
+        std::vector<vec3> bs_wo; /**< Local direction of the MIS ray. */
+        std::vector<Spectrum> bs_value; /**< BRDF over density of the MIS ray. */
+        std::vector<Float> mis_light_pdf; /**< Light density of the MIS ray. */
+        std::vector<Spectrum> direct; /**< Direct lighting estimate. */
+    };
+
+    /**
+     * @brief Queues of path indices, and the ray buffers given to Embree.
+     */
+    struct Queues {
+        std::vector<uint32_t> active; /**< Paths to intersect. */
+        std::vector<uint32_t> next; /**< Paths to intersect at the next wave. */
+        std::vector<uint32_t> shaded; /**< Paths hitting a surface with a BRDF. */
+        std::vector<uint32_t> lit; /**< Paths with a shadow ray. */
+        std::vector<uint32_t> mis; /**< Paths with a MIS ray. */
+
+        std::vector<RTCRayHit> rayhits;
+        std::vector<RTCRay> shadow_rays;
+        std::vector<uint8_t> occluded;
+    };
+
+    /**
+     * @brief Intersection of the active paths.
+     */
+    void trace_paths(Paths& paths, Queues& q, Scene& scene, const bool& coherent)
+    {
+        q.rayhits.resize(q.active.size());
+        for (uint32_t i = 0; i < q.active.size(); i++) {
+            uint32_t p = q.active[i];
+            Scene::init_rayhit(Ray(paths.ray_o[p], paths.ray_d[p]), q.rayhits[i]);
+        }
+
+        scene.intersect_stream(q.rayhits.data(), q.rayhits.size(), coherent);
+
+        q.shaded.clear();
+
+        SurfaceInteraction si;
+        for (uint32_t i = 0; i < q.active.size(); i++) {
+            uint32_t p = q.active[i];
+            Ray r(paths.ray_o[p], paths.ray_d[p]);
+
+            if (!scene.surface_interaction(r, q.rayhits[i], si)) {
+                if (paths.depth[p] == 0) {
+                    for (const auto& light : scene.infinite_lights) {
+                        paths.radiance[p] += paths.throughput[p] * light->eval(r.d);
+                    }
+                }
+                continue;
+            }
+
+            paths.set_interaction(p, si);
+
+            if (!si.brdf) {
+                paths.ray_o[p] = si.pos + r.d * 0.00001f;
+                q.next.push_back(p);
+                continue;
+            }
+
+            q.shaded.push_back(p);
+        }
+    }
+
+    /**
+     * @brief Emission, light sampling and generation of the shadow rays.
+     */
+    void shade_hits(Paths& paths, Queues& q, Scene& scene)
+    {
+        size_t n_light = scene.lights.size() + scene.infinite_lights.size();
+
+        q.lit.clear();
+        q.shadow_rays.clear();
+        for (uint32_t p : q.shaded) {
+            const vec3& d = paths.ray_d[p];
+            Sampler& sampler = paths.sampler[p];
+
+            if (paths.depth[p] == 0) {
+                paths.radiance[p] += paths.throughput[p] * paths.brdf[p]->emission();
+            }
+
+            if (n_light == 0)
+                continue;
+
+            const std::shared_ptr<Light>& light = scene.sps->sample(paths.pos[p], sampler.next_float(), &paths.light_pdf[p]);
+            paths.light[p] = light.get();
+
+            bool flip = glm::dot(paths.nor[p], -d) < 0.;
+            if (flip) {
+                paths.pos[p] += -paths.nor[p] * 0.00001f;
+            }
+            else {
+                paths.pos[p] +=  paths.nor[p] * 0.00001f;
+            }
+
+            SurfaceInteraction si = paths.interaction(p);
+            Light::Sample ls = light->sample(si, sampler);
+            assert(ls.pdf > 0.);
+            paths.ls_direction[p] = ls.direction;
+            paths.ls_emission[p] = ls.emission;
+            paths.ls_pdf[p] = ls.pdf;
+
+            paths.wo[p] = si.to_local(-ls.direction);
+            paths.wi[p] = si.to_local(-d);
+            if (flip) {
+                paths.wi[p] = -paths.wi[p];
+                paths.wo[p] = -paths.wo[p];
+            }
+
+            q.shadow_rays.emplace_back();
+            Scene::init_ray(Ray(si.pos, -ls.direction), q.shadow_rays.back(),
+                light->is_infinite() ? std::numeric_limits<Float>::infinity() : ls.expected_distance_to_intersection - Scene::occlusion_epsilon);
+            q.lit.push_back(p);
+        }
+    }
+
+    /**
+     * @brief Visibility of the light samples.
+     */
+    void trace_shadows(Paths& paths, Queues& q, Scene& scene)
+    {
+        q.occluded.resize(q.lit.size());
+        scene.occluded_stream(q.shadow_rays.data(), q.occluded.data(), q.lit.size());
+    }
+
+    /**
+     * @brief Contribution of the light samples and generation of the MIS rays.
+     */
+    void shade_direct(Paths& paths, Queues& q, Scene& scene)
+    {
+        q.mis.clear();
+        q.rayhits.clear();
+
+        for (uint32_t i = 0; i < q.lit.size(); i++) {
+            uint32_t p = q.lit[i];
+            SurfaceInteraction si = paths.interaction(p);
+            Brdf* brdf = paths.brdf[p];
+            Sampler& sampler = paths.sampler[p];
+            Light* light = paths.light[p];
+            const vec3& wi = paths.wi[p];
+            const vec3& wo = paths.wo[p];
+
+            Spectrum& contrib = paths.direct[p];
+            contrib = vec3(0.);
+
+            if (!q.occluded[i]) {
+
+                if (wi.z < 0.00001) {
+                    finish_direct(paths, p);
+                    continue;
+                }
+
+                Spectrum brdf_contrib = brdf->eval(wi, wo, si, sampler);
+                #if defined(USE_MIS)
+                if (light->is_dirac()) {
+                    contrib += brdf_contrib * paths.ls_emission[p];
+                } else {
+                    Float brdf_pdf = brdf->pdf(wi, wo, si);
+                    assert(brdf_pdf == brdf_pdf);
+                    Float weight = power_heuristic(paths.ls_pdf[p], brdf_pdf);
+                    assert(weight == weight);
+                    contrib += weight * brdf_contrib * paths.ls_emission[p] / paths.ls_pdf[p];
+                    assert(contrib == contrib);
+                }
+                #else
+                Spectrum light_fac = paths.ls_emission[p] / paths.ls_pdf[p];
+                contrib += light_fac * brdf_contrib;
+                #endif
+            }
+
+            #if defined(USE_MIS)
+            if (!light->is_dirac()) {
+                Brdf::Sample bs = brdf->sample(wi, si, sampler);
+                paths.bs_wo[p] = bs.wo;
+                paths.bs_value[p] = bs.value;
+                if (wi.z < 0.00001 || bs.wo.z < 0.00001) {
+                    finish_direct(paths, p);
+                    continue;
+                }
+
+                paths.mis_light_pdf[p] = light->pdf(si.pos, -si.to_world(bs.wo));
+                if (paths.mis_light_pdf[p] == 0) {
+                    finish_direct(paths, p);
+                    continue;
+                }
+
+                q.rayhits.emplace_back();
+                Scene::init_rayhit(Ray(si.pos - paths.ray_d[p] * 0.0001f, si.to_world(bs.wo)), q.rayhits.back());
+                q.mis.push_back(p);
+                continue;
+            }
+            #endif
+
+            finish_direct(paths, p);
+        }
+    }
+
+    /**
+     * @brief Contribution of the MIS rays hitting their light.
+     */
+    void trace_mis(Paths& paths, Queues& q, Scene& scene)
+    {
+        scene.intersect_stream(q.rayhits.data(), q.mis.size());
+
+        for (uint32_t i = 0; i < q.mis.size(); i++) {
+            uint32_t p = q.mis[i];
+            Light* light = paths.light[p];
+            const vec3& bs_wo = paths.bs_wo[p];
+            bool intersection = q.rayhits[i].hit.geomID != RTC_INVALID_GEOMETRY_ID;
+            unsigned int geom_id = Scene::hit_geometry(q.rayhits[i].hit);
+
+            // Ignore if we intersect a non emissive geometry or a light that is not this specific light
+            if (intersection) {
+                const std::shared_ptr<Brdf>& brdf = scene.geometries[geom_id]->brdf;
+                if (!brdf || !brdf->is_emissive() || (unsigned int)light->geometry_id() != geom_id) {
+                    finish_direct(paths, p);
+                    continue;
+                }
+            }
+
+            // Ignore if there is no intersection but this specific light is not at infinity
+            if (!intersection && !light->is_infinite()) {
+                finish_direct(paths, p);
+                continue;
+            }
+
+            SurfaceInteraction si = paths.interaction(p);
+            Spectrum emission = light->eval(si.to_world(bs_wo));
+            Float brdf_pdf = paths.brdf[p]->pdf(paths.wi[p], bs_wo, si);
+            Float weight = power_heuristic(brdf_pdf, paths.mis_light_pdf[p]);
+            assert(weight == weight);
+            paths.direct[p] += weight * paths.bs_value[p] * emission;
+
+            finish_direct(paths, p);
+        }
+    }
+
+    /**
+     * @brief Add the direct lighting estimate of a path to its radiance.
+     */
+    void finish_direct(Paths& paths, const uint32_t& p)
+    {
+        paths.radiance[p] += paths.throughput[p] * (paths.direct[p] / paths.light_pdf[p]);
+    }
+
+    /**
+     * @brief BRDF sampling of the next bounce and russian roulette.
+     */
+    void continue_paths(Paths& paths, Queues& q)
+    {
+        for (uint32_t p : q.shaded) {
+            const vec3 d = paths.ray_d[p];
+            SurfaceInteraction si = paths.interaction(p);
+            Brdf* brdf = paths.brdf[p];
+            Sampler& sampler = paths.sampler[p];
+            Spectrum& throughput = paths.throughput[p];
+
+            vec3 wi = si.to_local(-d);
+
+            bool two_sided = true;
+            bool flip = two_sided && wi.z < 0.;
+            if (flip) {
+                wi = -wi;
+            }
+
+            Brdf::Sample bs = brdf->sample(wi, si, sampler);
+
+            if (bs.wo.z < 0.0001 || wi.z < 0.0001)
+                continue;
+
+            #if !defined(SAMPLE_OPTIM)
+            Float wo_pdf = brdf->pdf(wi, bs.wo, si);
+            Spectrum brdf_cos_weighted = brdf->eval(wi, bs.wo, si, sampler);
+            throughput *= brdf_cos_weighted / wo_pdf;
+            assert(throughput == throughput);
+            #else
+            throughput *= bs.value;
+            #endif
+
+            if (flip) {
+                bs.wo = -bs.wo;
+            }
+
+            // offset si.pos for next bounce
+            paths.ray_o[p] = si.pos - d * 0.00001f;
+            paths.ray_d[p] = si.to_world(bs.wo);
+
+            Float maxRrBeta = glm::max(throughput.x, throughput.y, throughput.z);
+            const Float rrThreshold = 0.2;
+
+            if (maxRrBeta < 0.000001)
+                continue;
+
+            if (maxRrBeta < rrThreshold && paths.depth[p] > 2) {
+                Float q_rr = std::max((Float).05, 1 - maxRrBeta);
+                if (sampler.next_float() < q_rr)
+                    continue;
+                throughput /= 1 - q_rr;
+                assert(throughput == throughput);
+            }
+
+            if (++paths.depth[p] < (uint32_t)max_depth)
+                q.next.push_back(p);
+        }
+    }
+};
+
+} // namespace LT_NAMESPACE